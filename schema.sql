@@ -17,13 +17,19 @@ CREATE TABLE IF NOT EXISTS `images` (
 CREATE TABLE IF NOT EXISTS `signatures` (
   `id` INTEGER PRIMARY KEY AUTOINCREMENT,
   `image_id` INTEGER NOT NULL,
-  `compressed_signature` BLOB(182) UNIQUE NOT NULL
+  `compressed_signature` BLOB(182) UNIQUE NOT NULL,
+  `sketch` BLOB
 );
 
 CREATE TABLE IF NOT EXISTS `words` (
-  `pos_and_word` BLOB(5) NOT NULL,
-  `signature_id` INTEGER NOT NULL
+  `word_key` INTEGER NOT NULL,
+  `signature_id` INTEGER NOT NULL,
+  PRIMARY KEY (`word_key`, `signature_id`)
+) WITHOUT ROWID;
+
+CREATE TABLE IF NOT EXISTS `word_frequencies` (
+  `word_key` INTEGER PRIMARY KEY,
+  `frequency` INTEGER NOT NULL
 );
 
-CREATE INDEX IF NOT EXISTS idx_pos_words ON words(pos_and_word);
 CREATE INDEX IF NOT EXISTS idx_image_digest ON images(digest);
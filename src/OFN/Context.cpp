@@ -17,154 +17,1802 @@
 
 #include <cstdio>
 #include <cstddef>
-#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <unordered_set>
+#include <algorithm>
+#include <numeric>
+#include <unistd.h>
 
 #include <openssl/sha.h>
 
 #include "SQLite3/SQLite3.h"
+#include "SQLite3/ConnectionPool.h"
 #include "OFN/Puzzle.h"
 
 #include "OFN/OFN.h"
 #include "OFN/Image.h"
 #include "OFN/Context.h"
+#include "OFN/WordIndex.h"
+#include "OFN/IndexFile.h"
+#include "OFN/SignatureStore.h"
+#include "OFN/SignatureCache.h"
+#include "OFN/ThreadPool.h"
+#include "OFN/MappedFile.h"
+#include "OFN/TopK.h"
 
 using namespace OFN;
 
+/**
+ * Get the path of the word index file that belongs to a database, which is
+ * the database path with its `.db` extension replaced by `.idx`.
+ */
+static std::string GetIndexFilePath(const std::string& database_path)
+{
+    const std::string extension = ".db";
+    auto path = database_path;
+
+    if (path.size() > extension.size() &&
+        path.compare(path.size() - extension.size(), extension.size(),
+                     extension) == 0)
+        path.resize(path.size() - extension.size());
+
+    return path + ".idx";
+}
+
+static const char* InsertImageSQL =
+    "INSERT INTO images (filename, digest) VALUES (?, ?)";
+static const char* InsertSignatureSQL =
+    "INSERT INTO signatures (image_id, compressed_signature, sketch) "
+    "VALUES(?, ?, ?)";
+static const char* InsertWordSQL =
+    "INSERT INTO words (word_key, signature_id) VALUES(?, ?)";
+
+/** Create the table that a legacy `words` table is migrated into. */
+static const char* CreateMigratedWordsSQL =
+    "CREATE TABLE words_migrated ("
+    "word_key INTEGER NOT NULL, "
+    "signature_id INTEGER NOT NULL, "
+    "PRIMARY KEY (word_key, signature_id)) WITHOUT ROWID";
+
+/** Count a word towards its document frequency. */
+static const char* UpdateWordFrequencySQL =
+    "INSERT INTO word_frequencies (word_key, frequency) VALUES(?, 1) "
+    "ON CONFLICT(word_key) DO UPDATE SET frequency = frequency + 1";
+
+/** Create the document frequency table. */
+static const char* CreateWordFrequenciesSQL =
+    "CREATE TABLE IF NOT EXISTS word_frequencies ("
+    "word_key INTEGER PRIMARY KEY, "
+    "frequency INTEGER NOT NULL)";
+
+/** Fill the document frequency table from the words table. */
+static const char* CountWordFrequenciesSQL =
+    "INSERT INTO word_frequencies (word_key, frequency) "
+    "SELECT word_key, COUNT(*) FROM words GROUP BY word_key";
+
 static void print_sqlite_trace(void* context, const char* sql)
 {
     (void)context;
     auto console = spdlog::get("console");
 
-    SPDLOG_TRACE(console, "SQL: {}", sql);
+    SPDLOG_TRACE(console, "SQL: {}", sql);
+}
+
+Context::Context(const std::string& path,
+                 const SQLite3::ConnectionOptions& options) :
+    Context(std::make_shared<SQLite3::ConnectionPool>(path, options))
+{
+}
+
+Context::Context(std::shared_ptr<SQLite3::ConnectionPool> connections) :
+    connections_(connections),
+    conn_(connections->GetWriter()),
+    puzzle_(std::make_shared<Puzzle::Context>()),
+    index_file_path_(GetIndexFilePath(connections->GetFilename())),
+    num_words_(Image::DEFAULT_WORDS),
+    min_votes_(MinVotes),
+    max_word_frequency_(MaxWordFrequency),
+    num_signatures_(-1),
+    legacy_words_(false)
+{
+    auto console = spdlog::get("console");
+
+    connections_->SetTrace(print_sqlite_trace);
+    console->debug("Using the {} distance kernel",
+                   Puzzle::GetDistanceKernelName(Puzzle::GetDistanceKernel()));
+
+    UpgradeSchema();
+    OpenIndexFile();
+}
+
+Context::~Context()
+{
+    auto console = spdlog::get("console");
+    auto stats = connections_->GetStatementCacheStats();
+
+    console->debug("Statement cache: {} hits, {} misses, {} evictions over {} "
+                   "read-only connections",
+                   stats.hits, stats.misses, stats.evictions,
+                   connections_->GetNumReaders());
+
+    if (signature_cache_)
+    {
+        auto cache = signature_cache_->GetStats();
+        auto lookups = cache.hits + cache.misses;
+
+        console->debug("Signature cache: {} hits, {} misses ({:.1f}% hit "
+                       "rate), {} evictions, {} signatures in {} bytes",
+                       cache.hits, cache.misses,
+                       lookups ? 100.0 * cache.hits / lookups : 0.0,
+                       cache.evictions, cache.entries, cache.size);
+    }
+}
+
+namespace
+{
+
+/**
+ * Get the column names of a table.
+ *
+ * @returns the column names, or an empty list if the table doesn't exist.
+ */
+std::vector<std::string> GetColumns(SQLite3::Connection& conn,
+                                    const std::string& table)
+{
+    std::vector<std::string> columns;
+    auto statement = conn.Prepare("PRAGMA table_info(" + table + ")");
+
+    if (!statement)
+        return columns;
+
+    while (auto row = statement->Step())
+    {
+        auto name = row.GetText(1);
+
+        columns.emplace_back(name.data(), name.size());
+    }
+
+    return columns;
+}
+
+/**
+ * Uncompress a signature into a buffer owned by the calling thread.
+ *
+ * The buffer is reused for every signature the thread uncompresses, so it
+ * doesn't allocate once it has grown to the size of a signature. The result
+ * is only valid until the next call on the same thread.
+ *
+ * @returns a pointer to the buffer, or nullptr if the signature is malformed.
+ */
+const std::vector<signed char>*
+UncompressSignature(const SQLite3::Data& signature)
+{
+    static thread_local std::vector<signed char> buffer;
+
+    if (!Puzzle::Uncompress(signature.data(), signature.size(), buffer))
+        return nullptr;
+
+    return &buffer;
+}
+
+/**
+ * Get the distance a candidate has to beat to make it into the matches.
+ */
+double GetCutoff(const TopK<Match>& matches, double threshold)
+{
+    if (matches.IsFull())
+        return std::min(threshold, matches.GetWorst().distance);
+
+    return threshold;
+}
+
+/**
+ * Check whether scoring further candidates can no longer change the matches.
+ *
+ * Sharing fewer words with the query does not bound a candidate's distance,
+ * so candidates further down the vote order may still be closer. The only
+ * safe stop is a full set of exact duplicates, which nothing can beat.
+ */
+bool CanStopScoring(const TopK<Match>& matches)
+{
+    return matches.IsFull() && matches.GetWorst().distance == 0.0;
+}
+
+}
+
+MatchVector Context::Search(const Image& image, size_t k, double threshold)
+{
+    TopK<Match> matches(k);
+
+    auto console = spdlog::get("console");
+
+    stats_ = SearchStats();
+
+    if (k == 0)
+        return MatchVector();
+
+    if (store_)
+    {
+        SearchExact(image, threshold, matches);
+    }
+    else
+    {
+        auto start = std::chrono::steady_clock::now();
+        WordKeys keys;
+        KeyListeners listeners;
+
+        image.GetWordKeys(keys);
+        keys.size = RemoveStopWords(keys.keys, keys.size);
+
+        for (auto key : keys)
+            listeners[key].push_back(0);
+
+        if (PlanSearch(listeners, 1).plan == SearchPlan::Scan)
+            ScanSignatures({ &image }, threshold, &matches);
+        else if (index_ || index_file_)
+            SearchIndex(image, keys, threshold, matches);
+        else
+            SearchDatabase(image, keys, threshold, matches);
+
+        LogPlan(start);
+    }
+
+    console->debug("Scored {} of {} candidates, {} rejected by sketch, {} "
+                   "common words ignored",
+                   stats_.candidates - stats_.prefiltered, stats_.candidates,
+                   stats_.prefiltered, stats_.stopped_words);
+
+    return matches.TakeSorted();
+}
+
+void Context::SearchExact(const Image& image, double threshold,
+                          TopK<Match>& matches)
+{
+    const size_t ChunkSize = 4096;
+
+    auto console = spdlog::get("console");
+    auto query = image.GetCvec();
+    auto count = store_->GetCount();
+
+    if (count > 0 && query->GetSize() != store_->GetVectorSize())
+    {
+        console->error("Signature size {} does not match the store size {}",
+                       query->GetSize(), store_->GetVectorSize());
+        return;
+    }
+
+    auto num_workers = pool_ ? pool_->GetNumThreads() : 1;
+    auto sketch = image.GetSketch().data();
+    auto sketch_words = Puzzle::GetSketchPlaneWords(store_->GetVectorSize());
+    std::vector<TopK<ScoredRow>> heaps(
+        num_workers, TopK<ScoredRow>(matches.GetCapacity()));
+    std::vector<size_t> prefiltered(num_workers);
+
+    // Score one chunk of the store into the heap of the worker running it,
+    // skipping rows whose sketch already rules them out.
+    auto scan = [&](size_t worker, size_t chunk) {
+        auto& heap = heaps[worker];
+        auto end = std::min(count, (chunk + 1) * ChunkSize);
+        size_t rejected = 0;
+
+        for (auto index = chunk * ChunkSize; index < end; index++)
+        {
+            auto cutoff = heap.IsFull()
+                              ? std::min(threshold, heap.GetWorst().first)
+                              : threshold;
+
+            if (Puzzle::SketchLowerBound(sketch, store_->GetSketch(index),
+                                         sketch_words) >= cutoff)
+            {
+                rejected++;
+                continue;
+            }
+
+            auto distance = Puzzle::NormalizedDistanceBounded(
+                query->GetVec(), store_->GetRow(index),
+                store_->GetVectorSize(), cutoff, sketch[0],
+                store_->GetSketch(index)[0]);
+
+            if (distance < cutoff)
+                heap.Push({ distance, index });
+        }
+
+        prefiltered[worker] += rejected;
+    };
+
+    auto num_chunks = (count + ChunkSize - 1) / ChunkSize;
+
+    if (pool_)
+    {
+        pool_->Run(num_chunks, scan);
+    }
+    else
+    {
+        for (size_t chunk = 0; chunk < num_chunks; chunk++)
+            scan(0, chunk);
+    }
+
+    for (size_t i = 1; i < heaps.size(); i++)
+        heaps[0].Merge(heaps[i]);
+
+    stats_.candidates += count;
+
+    for (auto rejected : prefiltered)
+        stats_.prefiltered += rejected;
+
+    AddStoreMatches(heaps[0], matches);
+}
+
+void Context::AddStoreMatches(TopK<ScoredRow>& rows, TopK<Match>& matches)
+{
+    auto console = spdlog::get("console");
+    auto conn = connections_->GetReader();
+    auto statement =
+        conn->Prepare("SELECT digest, filename FROM images WHERE(id = ?)");
+
+    if (!statement)
+    {
+        console->error("Error when preparing statement: {}",
+                       conn->GetErrorMessage());
+        return;
+    }
+
+    for (auto& scored : rows.TakeSorted())
+    {
+        auto image_id = store_->GetImageID(scored.second);
+
+        statement->Bind(1, image_id);
+
+        if (auto row = statement->Step())
+        {
+            auto digest = row.GetBlob(0);
+            auto filename = row.GetText(1);
+
+            matches.Push({ image_id, store_->GetSignatureID(scored.second),
+                           std::string(filename.data(), filename.size()),
+                           std::string(digest.data(), digest.size()),
+                           scored.first });
+        }
+
+        statement->Reset();
+    }
+}
+
+std::vector<MatchVector>
+Context::SearchBatch(const std::vector<const Image*>& images, size_t k,
+                     double threshold)
+{
+    auto console = spdlog::get("console");
+    std::vector<TopK<Match>> matches(images.size(), TopK<Match>(k));
+    std::vector<MatchVector> result;
+
+    stats_ = SearchStats();
+
+    if (k > 0 && !images.empty())
+    {
+        if (store_)
+        {
+            SearchExactBatch(images, threshold, matches);
+        }
+        else
+        {
+            auto start = std::chrono::steady_clock::now();
+
+            SearchWordsBatch(images, threshold, matches);
+            LogPlan(start);
+        }
+    }
+
+    console->debug("Scored {} of {} candidates for {} images, {} rejected by "
+                   "sketch, {} common words ignored",
+                   stats_.candidates - stats_.prefiltered, stats_.candidates,
+                   images.size(), stats_.prefiltered, stats_.stopped_words);
+
+    result.reserve(images.size());
+
+    for (auto& heap : matches)
+        result.push_back(heap.TakeSorted());
+
+    return result;
+}
+
+void Context::SearchExactBatch(const std::vector<const Image*>& images,
+                               double threshold,
+                               std::vector<TopK<Match>>& matches)
+{
+    const size_t ChunkSize = 4096;
+
+    auto console = spdlog::get("console");
+    auto count = store_->GetCount();
+    auto size = store_->GetVectorSize();
+    auto num_queries = images.size();
+
+    // Pack the queries next to each other so every row of the store can be
+    // scored against all of them in a single call while it is in cache.
+    std::vector<signed char> queries(num_queries * size);
+
+    for (size_t i = 0; i < num_queries && count > 0; i++)
+    {
+        auto cvec = images[i]->GetCvec();
+
+        if (cvec->GetSize() != size)
+        {
+            console->error("Signature size {} does not match the store size "
+                           "{}",
+                           cvec->GetSize(), size);
+            return;
+        }
+
+        memcpy(&queries[i * size], cvec->GetVec(), size);
+    }
+
+    auto num_workers = pool_ ? pool_->GetNumThreads() : 1;
+    auto sketch_words = Puzzle::GetSketchPlaneWords(size);
+    TopK<ScoredRow> empty_heap(matches[0].GetCapacity());
+    std::vector<std::vector<TopK<ScoredRow>>> heaps(
+        num_workers, std::vector<TopK<ScoredRow>>(num_queries, empty_heap));
+    std::vector<size_t> prefiltered(num_workers);
+
+    // Score one chunk of the store into the heaps of the worker running it.
+    // As in SearchExact, a query skips every row its sketch already rules
+    // out, and rows ruled out for all queries are not scored at all.
+    auto scan = [&](size_t worker, size_t chunk) {
+        std::vector<double> distances(num_queries);
+        std::vector<double> cutoffs(num_queries);
+        auto& worker_heaps = heaps[worker];
+        auto end = std::min(count, (chunk + 1) * ChunkSize);
+        size_t rejected = 0;
+
+        for (auto index = chunk * ChunkSize; index < end; index++)
+        {
+            auto row_sketch = store_->GetSketch(index);
+            size_t remaining = 0;
+
+            for (size_t i = 0; i < num_queries; i++)
+            {
+                auto& heap = worker_heaps[i];
+
+                cutoffs[i] = heap.IsFull()
+                                 ? std::min(threshold, heap.GetWorst().first)
+                                 : threshold;
+
+                if (Puzzle::SketchLowerBound(images[i]->GetSketch().data(),
+                                             row_sketch, sketch_words) >=
+                    cutoffs[i])
+                {
+                    cutoffs[i] = 0.0;
+                    rejected++;
+                }
+                else
+                {
+                    remaining++;
+                }
+            }
+
+            if (remaining == 0)
+                continue;
+
+            Puzzle::NormalizedDistances(store_->GetRow(index), queries.data(),
+                                        size, size, num_queries,
+                                        distances.data());
+
+            for (size_t i = 0; i < num_queries; i++)
+            {
+                if (distances[i] < cutoffs[i])
+                    worker_heaps[i].Push({ distances[i], index });
+            }
+        }
+
+        prefiltered[worker] += rejected;
+    };
+
+    auto num_chunks = (count + ChunkSize - 1) / ChunkSize;
+
+    if (pool_)
+    {
+        pool_->Run(num_chunks, scan);
+    }
+    else
+    {
+        for (size_t chunk = 0; chunk < num_chunks; chunk++)
+            scan(0, chunk);
+    }
+
+    stats_.candidates += count * num_queries;
+
+    for (auto rejected : prefiltered)
+        stats_.prefiltered += rejected;
+
+    for (size_t i = 0; i < num_queries; i++)
+    {
+        for (size_t worker = 1; worker < num_workers; worker++)
+            heaps[0][i].Merge(heaps[worker][i]);
+
+        AddStoreMatches(heaps[0][i], matches[i]);
+    }
+}
+
+void Context::SearchWordsBatch(const std::vector<const Image*>& images,
+                               double threshold,
+                               std::vector<TopK<Match>>& matches)
+{
+    auto conn = connections_->GetReader();
+    auto console = spdlog::get("console");
+    auto num_queries = images.size();
+
+    // Collect every distinct word together with the queries containing it,
+    // so each posting list is only read once for the whole batch.
+    KeyListeners listeners;
+
+    WordKeys query_keys;
+
+    for (uint32_t i = 0; i < num_queries; i++)
+    {
+        images[i]->GetWordKeys(query_keys);
+
+        for (auto key : query_keys)
+        {
+            auto& queries = listeners[key];
+
+            if (queries.empty() || queries.back() != i)
+                queries.push_back(i);
+        }
+    }
+
+    // Words above the stoplist cutoff are dropped for the whole batch at
+    // once.
+    if (max_word_frequency_ < 1.0)
+    {
+        std::vector<WordKey> keys;
+
+        keys.reserve(listeners.size());
+
+        for (auto& listener : listeners)
+            keys.push_back(listener.first);
+
+        auto num_keys = RemoveStopWords(keys.data(), keys.size());
+
+        for (size_t i = num_keys; i < keys.size(); i++)
+            listeners.erase(keys[i]);
+    }
+
+    if (PlanSearch(listeners, num_queries).plan == SearchPlan::Scan)
+    {
+        ScanSignatures(images, threshold, matches.data());
+        return;
+    }
+
+    std::vector<std::unordered_map<uint32_t, int>> votes(num_queries);
+
+    auto vote = [&](const std::vector<uint32_t>& queries,
+                    uint32_t signature_id) {
+        for (auto query : queries)
+            votes[query][signature_id]++;
+    };
+
+    if (index_)
+    {
+        for (auto& listener : listeners)
+        {
+            if (auto list = index_->Find(listener.first))
+            {
+                for (auto id : *list)
+                    vote(listener.second, id);
+
+                stats_.postings += list->size();
+            }
+        }
+    }
+    else
+    {
+        int64_t max_signature_id = 0;
+
+        if (index_file_)
+        {
+            std::vector<uint32_t> ids;
+
+            for (auto& listener : listeners)
+            {
+                if (auto entry = index_file_->Find(listener.first))
+                {
+                    ids.clear();
+                    index_file_->Decode(*entry, ids);
+
+                    for (auto id : ids)
+                        vote(listener.second, id);
+
+                    stats_.postings += ids.size();
+                }
+            }
+
+            max_signature_id = index_file_->GetMaxSignatureID();
+        }
+
+        // Whatever the index file does not cover comes from the words table,
+        // with every distinct word of the batch in one query.
+        std::vector<WordIndex::Key> keys;
+
+        keys.reserve(listeners.size());
+
+        for (auto& listener : listeners)
+            keys.push_back(listener.first);
+
+        auto statement = conn->Prepare(
+            "SELECT word_key, signature_id FROM words "
+            "WHERE signature_id > ? AND word_key IN int_array(?)");
+
+        if (!statement)
+        {
+            console->error("Error when preparing statement: {}",
+                           conn->GetErrorMessage());
+            return;
+        }
+
+        SQLite3::IntArray key_array(keys);
+
+        statement->Bind(1, max_signature_id);
+        statement->Bind(2, key_array);
+
+        while (auto row = statement->Step())
+        {
+            auto it = listeners.find(row.GetInt64(0));
+
+            stats_.postings++;
+
+            if (it != listeners.end())
+                vote(it->second, static_cast<uint32_t>(row.GetInt64(1)));
+        }
+    }
+
+    // Group the ranked candidates of every query by signature, in id order so
+    // the lookups walk the signatures table sequentially.
+    std::map<int64_t, std::vector<uint32_t>> candidates;
+
+    for (uint32_t i = 0; i < num_queries; i++)
+    {
+        for (auto& candidate : RankVotes(votes[i], MaxCandidates, min_votes_))
+            candidates[candidate.signature_id].push_back(i);
+    }
+
+    auto statement = conn->Prepare(
+        "SELECT signatures.compressed_signature, images.id, images.digest, "
+        "images.filename, signatures.sketch FROM signatures "
+        "INNER JOIN images ON images.id = signatures.image_id "
+        "WHERE(signatures.id = ?)");
+
+    if (!statement)
+    {
+        console->error("Error when preparing statement: {}",
+                       conn->GetErrorMessage());
+        return;
+    }
+
+    for (auto& candidate : candidates)
+    {
+        auto& queries = candidate.second;
+
+        // Apply the stopping rule of Search to each query on its own.
+        queries.erase(std::remove_if(queries.begin(), queries.end(),
+                                     [&matches](uint32_t query) {
+                                         return CanStopScoring(matches[query]);
+                                     }),
+                      queries.end());
+
+        if (queries.empty())
+            continue;
+
+        auto entry = FindCachedSignature(candidate.first);
+
+        if (!entry && signature_cache_)
+        {
+            statement->Bind(1, candidate.first);
+            stats_.fetches++;
+
+            if (auto row = statement->Step())
+                entry = CacheSignature(candidate.first, row);
+
+            statement->Reset();
+        }
+
+        if (entry)
+        {
+            for (auto query : candidate.second)
+                ScoreSignature(*images[query], { candidate.first, 0 }, *entry,
+                               threshold, matches[query]);
+
+            continue;
+        }
+
+        statement->Bind(1, candidate.first);
+        stats_.fetches++;
+
+        // Read the signature once and score it against every query that
+        // ranked it.
+        if (auto row = statement->Step())
+            ScoreRow(images, candidate.second, candidate.first, row, threshold,
+                     matches.data());
+
+        statement->Reset();
+    }
+}
+
+void Context::SearchDatabase(const Image& image, const WordKeys& keys,
+                             double threshold, TopK<Match>& matches)
+{
+    auto console = spdlog::get("console");
+    auto conn = connections_->GetReader();
+
+    // Find every signature that shares at least one word with the query
+    // together with its image, and rank them by the number of shared words so
+    // the most promising candidates are scored first.
+    auto statement = conn->Prepare(
+        "SELECT signatures.compressed_signature, images.id, images.digest, "
+        "images.filename, signatures.sketch, signatures.id, "
+        "COUNT(*) AS votes FROM words "
+        "INNER JOIN signatures ON signatures.id = words.signature_id "
+        "INNER JOIN images ON images.id = signatures.image_id "
+        "WHERE words.word_key IN int_array(?) "
+        "GROUP BY words.signature_id "
+        "HAVING votes >= ? "
+        "ORDER BY votes DESC "
+        "LIMIT ?");
+
+    if (!statement)
+    {
+        console->error("Error when preparing statement: {}",
+                       conn->GetErrorMessage());
+        return;
+    }
+
+    SQLite3::IntArray key_array(keys.keys, keys.size);
+
+    statement->Bind(1, key_array);
+    statement->Bind(2, min_votes_);
+    statement->Bind(3, MaxCandidates);
+
+    // The grouping reads every posting of the query words before the first
+    // row comes back.
+    stats_.postings += stats_.plan.postings;
+
+    // Iterate over each candidate in descending vote order.
+    while (auto row = statement->Step())
+    {
+        Candidate candidate{ row.GetInt64(5), row.GetInt(6) };
+
+        if (CanStopScoring(matches))
+            break;
+
+        stats_.fetches++;
+
+        // The row has been read either way, but a cached signature is scored
+        // as is instead of being added to the cache again.
+        if (auto entry = FindCachedSignature(candidate.signature_id))
+            ScoreSignature(image, candidate, *entry, threshold, matches);
+        else
+            ScoreCandidate(image, candidate, row, threshold, matches);
+    }
+}
+
+void Context::SearchIndex(const Image& image, const WordKeys& keys,
+                          double threshold, TopK<Match>& matches)
+{
+    auto console = spdlog::get("console");
+    auto conn = connections_->GetReader();
+    std::unordered_map<uint32_t, int> votes;
+
+    if (index_)
+    {
+        index_->Vote(keys, votes);
+    }
+    else
+    {
+        index_file_->Vote(keys, votes);
+
+        // Signatures committed after the index file was built are only found
+        // in the words table.
+        if (!VoteRecentWords(keys, index_file_->GetMaxSignatureID(), votes))
+            console->error("Error when voting on recent words: {}",
+                           conn->GetErrorMessage());
+    }
+
+    // Every posting read is one vote.
+    for (auto& vote : votes)
+        stats_.postings += vote.second;
+
+    auto candidates = RankVotes(votes, MaxCandidates, min_votes_);
+
+    auto statement = conn->Prepare(
+        "SELECT signatures.compressed_signature, images.id, images.digest, "
+        "images.filename, signatures.sketch FROM signatures "
+        "INNER JOIN images ON images.id = signatures.image_id "
+        "WHERE(signatures.id = ?)");
+
+    if (!statement)
+    {
+        console->error("Error when preparing statement: {}",
+                       conn->GetErrorMessage());
+        return;
+    }
+
+    for (auto& candidate : candidates)
+    {
+        if (CanStopScoring(matches))
+            break;
+
+        if (auto entry = FindCachedSignature(candidate.signature_id))
+        {
+            ScoreSignature(image, candidate, *entry, threshold, matches);
+            continue;
+        }
+
+        statement->Bind(1, candidate.signature_id);
+        stats_.fetches++;
+
+        if (auto row = statement->Step())
+            ScoreCandidate(image, candidate, row, threshold, matches);
+
+        statement->Reset();
+    }
+}
+
+void Context::ScanSignatures(const std::vector<const Image*>& images,
+                             double threshold, TopK<Match>* matches)
+{
+    auto console = spdlog::get("console");
+    auto conn = connections_->GetReader();
+    std::vector<uint32_t> queries(images.size());
+
+    std::iota(queries.begin(), queries.end(), 0);
+
+    auto statement = conn->Prepare(
+        "SELECT signatures.compressed_signature, images.id, images.digest, "
+        "images.filename, signatures.sketch, signatures.id FROM signatures "
+        "INNER JOIN images ON images.id = signatures.image_id "
+        "ORDER BY signatures.id");
+
+    if (!statement)
+    {
+        console->error("Error when preparing statement: {}",
+                       conn->GetErrorMessage());
+        return;
+    }
+
+    while (auto row = statement->Step())
+    {
+        stats_.rows_read++;
+
+        ScoreRow(images, queries, row.GetInt64(5), row, threshold, matches);
+    }
+}
+
+const PlanEstimate& Context::PlanSearch(const KeyListeners& listeners,
+                                        size_t num_queries)
+{
+    auto console = spdlog::get("console");
+    auto num_signatures = static_cast<size_t>(GetNumSignatures());
+    std::unordered_map<WordKey, size_t> frequencies;
+    std::vector<size_t> query_postings(num_queries);
+    size_t postings = 0;
+    size_t candidates = 0;
+
+    if (!GetWordFrequencies(listeners, frequencies))
+        console->error("Error when looking up word frequencies");
+
+    for (auto& frequency : frequencies)
+    {
+        postings += frequency.second;
+
+        for (auto query : listeners.at(frequency.first))
+            query_postings[query] += frequency.second;
+    }
+
+    // A signature needs as many postings as the minimum number of votes to
+    // become a candidate, and no more than MaxCandidates are looked up.
+    for (auto count : query_postings)
+        candidates += std::min({ count / min_votes_, num_signatures,
+                                 static_cast<size_t>(MaxCandidates) });
+
+    stats_.plan =
+        planner_.Plan(postings, candidates, num_signatures, num_queries);
+
+    return stats_.plan;
+}
+
+bool Context::GetWordFrequencies(
+    const KeyListeners& listeners,
+    std::unordered_map<WordKey, size_t>& frequencies)
+{
+    if (index_)
+    {
+        for (auto& listener : listeners)
+        {
+            if (auto list = index_->Find(listener.first))
+                frequencies[listener.first] = list->size();
+        }
+
+        return true;
+    }
+
+    // The frequencies table also covers the signatures committed after the
+    // index file was built.
+    auto conn = connections_->GetReader();
+    std::vector<WordKey> keys;
+
+    keys.reserve(listeners.size());
+
+    for (auto& listener : listeners)
+        keys.push_back(listener.first);
+
+    auto statement = conn->Prepare(
+        "SELECT word_key, frequency FROM word_frequencies "
+        "WHERE word_key IN int_array(?)");
+
+    if (!statement)
+        return false;
+
+    SQLite3::IntArray key_array(keys);
+
+    statement->Bind(1, key_array);
+
+    while (auto row = statement->Step())
+        frequencies[row.GetInt64(0)] = static_cast<size_t>(row.GetInt64(1));
+
+    return statement->IsDone();
+}
+
+void Context::LogPlan(std::chrono::steady_clock::time_point start) const
+{
+    auto console = spdlog::get("console");
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    auto distances = stats_.candidates - stats_.prefiltered;
+    double cost;
+
+    if (stats_.plan.plan == SearchPlan::Scan)
+        cost = planner_.GetScanCost(stats_.rows_read, distances);
+    else
+        cost = planner_.GetWordsCost(stats_.postings, stats_.fetches,
+                                     distances);
+
+    console->debug("Chose the {} plan for {} postings and {} candidates, "
+                   "estimated at {:.0f}us by word and {:.0f}us by scan; the "
+                   "work done is modeled at {:.0f}us and took {}us",
+                   GetSearchPlanName(stats_.plan.plan), stats_.plan.postings,
+                   stats_.plan.candidates, stats_.plan.words_cost,
+                   stats_.plan.scan_cost, cost, elapsed.count());
+}
+
+bool Context::VoteRecentWords(const WordKeys& keys,
+                              int64_t signature_id,
+                              std::unordered_map<uint32_t, int>& votes)
+{
+    auto conn = connections_->GetReader();
+    auto statement = conn->Prepare(
+        "SELECT signature_id, COUNT(*) FROM words "
+        "WHERE signature_id > ? AND word_key IN int_array(?) "
+        "GROUP BY signature_id");
+
+    if (!statement)
+        return false;
+
+    SQLite3::IntArray key_array(keys.keys, keys.size);
+
+    statement->Bind(1, signature_id);
+    statement->Bind(2, key_array);
+
+    while (auto row = statement->Step())
+        votes[static_cast<uint32_t>(row.GetInt64(0))] += row.GetInt(1);
+
+    return statement->IsDone();
+}
+
+size_t Context::RemoveStopWords(WordKey* keys, size_t count)
+{
+    if (max_word_frequency_ >= 1.0 || count == 0)
+        return count;
+
+    auto console = spdlog::get("console");
+    auto conn = connections_->GetReader();
+    // Rounding up keeps a small collection from treating every word it has
+    // seen at all as a stop word.
+    auto cutoff = std::max<int64_t>(
+        1, static_cast<int64_t>(
+               std::ceil(max_word_frequency_ * GetNumSignatures())));
+    std::unordered_set<WordKey> stopped;
+
+    {
+        auto statement = conn->Prepare(
+            "SELECT word_key FROM word_frequencies "
+            "WHERE word_key IN int_array(?) AND frequency > ?");
+
+        if (!statement)
+        {
+            console->error("Error when preparing statement: {}",
+                           conn->GetErrorMessage());
+            return count;
+        }
+
+        SQLite3::IntArray key_array(keys, count);
+
+        statement->Bind(1, key_array);
+        statement->Bind(2, cutoff);
+
+        while (auto row = statement->Step())
+            stopped.insert(row.GetInt64(0));
+    }
+
+    if (stopped.empty())
+        return count;
+
+    stats_.stopped_words += stopped.size();
+
+    auto end = std::partition(keys, keys + count, [&](WordKey key) {
+        return stopped.count(key) == 0;
+    });
+
+    return end - keys;
+}
+
+int64_t Context::GetNumSignatures()
+{
+    if (num_signatures_ >= 0)
+        return num_signatures_;
+
+    auto conn = connections_->GetReader();
+    auto statement = conn->Prepare("SELECT COUNT(*) FROM signatures");
+
+    num_signatures_ = 0;
+
+    if (statement)
+    {
+        if (auto row = statement->Step())
+            num_signatures_ = row.GetInt64(0);
+    }
+
+    return num_signatures_;
+}
+
+CandidateReport Context::ReportCandidates(const Image& image)
+{
+    auto console = spdlog::get("console");
+    CandidateReport report;
+    WordKeys keys;
+    std::unordered_map<uint32_t, int> votes;
+
+    image.GetWordKeys(keys);
+    report.words = keys.size;
+
+    if (!VoteRecentWords(keys, 0, votes))
+        console->error("Error when counting candidates");
+
+    report.candidates = votes.size();
+
+    keys.size = RemoveStopWords(keys.keys, keys.size);
+    report.stopped_words = report.words - keys.size;
+
+    votes.clear();
+
+    if (!VoteRecentWords(keys, 0, votes))
+        console->error("Error when counting candidates");
+
+    for (auto& vote : votes)
+    {
+        if (vote.second >= min_votes_)
+            report.selected++;
+    }
+
+    return report;
+}
+
+void Context::ScoreCandidate(const Image& image, const Candidate& candidate,
+                             const SQLite3::Row& row, double threshold,
+                             TopK<Match>& matches)
+{
+    auto console = spdlog::get("console");
+
+    if (signature_cache_)
+    {
+        if (auto entry = CacheSignature(candidate.signature_id, row))
+            ScoreSignature(image, candidate, *entry, threshold, matches);
+
+        return;
+    }
+
+    auto cutoff = GetCutoff(matches, threshold);
+    uint64_t length;
+
+    stats_.candidates++;
+
+    if (RejectBySketch(image, row.GetBlob(4), cutoff, length))
+        return;
+
+    auto signature = row.GetBlob(0);
+    double distance;
+
+    if (!image.CompareCompressed(signature.data(), signature.size(), cutoff,
+                                 distance, length))
+        return;
+
+    console->debug("Candidate {:d} with {:d} votes has distance {}",
+                   candidate.signature_id, candidate.votes, distance);
+
+    if (distance >= cutoff)
+        return;
+
+    auto digest = row.GetBlob(2);
+    auto filename = row.GetText(3);
+
+    matches.Push({ row.GetInt64(1), candidate.signature_id,
+                   std::string(filename.data(), filename.size()),
+                   std::string(digest.data(), digest.size()), distance });
+}
+
+void Context::ScoreRow(const std::vector<const Image*>& images,
+                       const std::vector<uint32_t>& queries,
+                       int64_t signature_id, const SQLite3::Row& row,
+                       double threshold, TopK<Match>* matches)
+{
+    auto signature = row.GetBlob(0);
+
+    for (auto query : queries)
+    {
+        auto& image = *images[query];
+        auto cutoff = GetCutoff(matches[query], threshold);
+        uint64_t length;
+
+        stats_.candidates++;
+
+        if (RejectBySketch(image, row.GetBlob(4), cutoff, length))
+            continue;
+
+        double distance;
+
+        if (!image.CompareCompressed(signature.data(), signature.size(),
+                                     cutoff, distance, length))
+            return;
+
+        if (distance >= cutoff)
+            continue;
+
+        auto digest = row.GetBlob(2);
+        auto filename = row.GetText(3);
+
+        matches[query].Push({ row.GetInt64(1), signature_id,
+                              std::string(filename.data(), filename.size()),
+                              std::string(digest.data(), digest.size()),
+                              distance });
+    }
+}
+
+void Context::ScoreSignature(const Image& image, const Candidate& candidate,
+                             const CachedSignature& signature, double threshold,
+                             TopK<Match>& matches)
+{
+    auto console = spdlog::get("console");
+    auto cutoff = GetCutoff(matches, threshold);
+    uint64_t length;
+
+    stats_.candidates++;
+
+    if (RejectBySketch(image,
+                       SQLite3::Data(signature.sketch.data(),
+                                     signature.sketch.size()),
+                       cutoff, length))
+        return;
+
+    double distance;
+
+    if (!image.CompareCompressed(signature.signature.data(),
+                                 signature.signature.size(), cutoff, distance,
+                                 length))
+        return;
+
+    console->debug("Candidate {:d} with {:d} votes has distance {}",
+                   candidate.signature_id, candidate.votes, distance);
+
+    if (distance >= cutoff)
+        return;
+
+    matches.Push({ signature.image_id, candidate.signature_id,
+                   signature.filename, signature.digest, distance });
+}
+
+SignatureCache::Entry Context::FindCachedSignature(int64_t signature_id)
+{
+    if (!signature_cache_)
+        return nullptr;
+
+    return signature_cache_->Find(signature_id);
+}
+
+SignatureCache::Entry Context::CacheSignature(int64_t signature_id,
+                                              const SQLite3::Row& row)
+{
+    auto signature = row.GetBlob(0);
+    auto digest = row.GetBlob(2);
+    auto filename = row.GetText(3);
+    auto sketch = row.GetBlob(4);
+    auto entry = std::make_shared<CachedSignature>();
+
+    if (Puzzle::GetUncompressedSize(signature.data(), signature.size()) == 0)
+        return nullptr;
+
+    entry->signature.assign(signature.data(), signature.size());
+    entry->image_id = row.GetInt64(1);
+    entry->digest.assign(digest.data(), digest.size());
+    entry->filename.assign(filename.data(), filename.size());
+    entry->sketch.assign(sketch.data(), sketch.size());
+
+    signature_cache_->Insert(signature_id, entry);
+
+    return entry;
 }
 
-Context::Context() :
-    conn_(std::make_shared<SQLite3::Connection>("ofn.db")),
-    puzzle_(std::make_shared<Puzzle::Context>())
+void Context::SetSignatureCacheSize(size_t budget)
 {
-    conn_->SetTrace(print_sqlite_trace);
+    if (budget > 0)
+        signature_cache_ = std::make_unique<SignatureCache>(budget);
+    else
+        signature_cache_.reset();
 }
 
-Context::~Context()
+SignatureCacheStats Context::GetSignatureCacheStats() const
+{
+    if (!signature_cache_)
+        return SignatureCacheStats();
+
+    return signature_cache_->GetStats();
+}
+
+bool Context::RejectBySketch(const Image& image, const SQLite3::Data& sketch,
+                             double cutoff, uint64_t& length)
 {
+    length = Puzzle::UnknownLength;
+
+    // Signatures committed before sketches existed have none, and are always
+    // scored in full.
+    if (sketch.size() != image.GetSketch().size() * sizeof(uint64_t))
+        return false;
+
+    sketch_buffer_.resize(image.GetSketch().size());
+    memcpy(sketch_buffer_.data(), sketch.data(), sketch.size());
+
+    length = sketch_buffer_[0];
+
+    auto bound = Puzzle::SketchLowerBound(
+        image.GetSketch().data(), sketch_buffer_.data(),
+        Puzzle::GetSketchPlaneWords(image.GetCvec()->GetSize()));
+
+    if (bound < cutoff)
+        return false;
+
+    stats_.prefiltered++;
+
+    return true;
 }
 
-void Context::Search(const Image& image)
+void Context::UpgradeSchema()
 {
     auto console = spdlog::get("console");
-    auto words = CompressWords(image.GetWords());
-    auto statement = conn_->Prepare(
-        "SELECT DISTINCT(signature_id) FROM words "
-        "WHERE pos_and_word IN (?, ?, ?, ?, ?, ?, ?, ?, "
-        "?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, "
-        "?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, "
-        "?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, "
-        "?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, "
-        "?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    auto columns = GetColumns(*conn_, "signatures");
 
-    for (auto i = 0; i < Image::MAX_WORDS; i++)
+    if (!columns.empty() &&
+        std::find(columns.begin(), columns.end(), "sketch") == columns.end())
     {
-        auto word = words[i];
-        statement->Bind(i + 1, word.data(), word.size(), true);
+        console->info("Adding the sketch column to the signatures table");
+
+        if (conn_->Execute("ALTER TABLE signatures ADD COLUMN sketch BLOB") !=
+            SQLITE_OK)
+            console->error("Failed to add the sketch column: {}",
+                           conn_->GetErrorMessage());
     }
 
-    auto signature_statement =
-        conn_->Prepare("SELECT image_id, compressed_signature FROM "
-                       "signatures WHERE(id = ?)");
+    columns = GetColumns(*conn_, "words");
+    legacy_words_ = std::find(columns.begin(), columns.end(),
+                              "pos_and_word") != columns.end();
+
+    // The document frequencies of a legacy database are counted when it is
+    // migrated.
+    if (columns.empty() || legacy_words_ ||
+        !GetColumns(*conn_, "word_frequencies").empty())
+        return;
 
-    auto image_statement =
-        conn_->Prepare("SELECT digest, filename FROM images WHERE(id = ?)");
+    console->info("Counting the document frequency of every word");
 
-    if (!signature_statement || !image_statement)
-        console->error("Error when preparing statement: {}",
+    conn_->Execute("BEGIN TRANSACTION");
+
+    if (conn_->Execute(CreateWordFrequenciesSQL) != SQLITE_OK ||
+        conn_->Execute(CountWordFrequenciesSQL) != SQLITE_OK)
+    {
+        console->error("Failed to count the word frequencies: {}",
                        conn_->GetErrorMessage());
+        conn_->Execute("ROLLBACK TRANSACTION");
+
+        return;
+    }
+
+    conn_->Execute("END TRANSACTION");
+}
+
+bool Context::MigrateWords()
+{
+    auto console = spdlog::get("console");
+    size_t num_signatures = 0;
+
+    if (!legacy_words_)
+    {
+        console->info("The words table is already up to date");
+
+        return true;
+    }
+
+    conn_->Execute("BEGIN TRANSACTION");
 
-    // Iterate over each row.
-    while (auto words_row = statement->Step())
+    try
     {
-        auto signature_id = words_row.GetInt64(0);
+        if (conn_->Execute(CreateMigratedWordsSQL) != SQLITE_OK)
+        {
+            console->error("Failed to create the new words table: {}",
+                           conn_->GetErrorMessage());
+            conn_->Execute("ROLLBACK TRANSACTION");
 
-        console->info("Got row with id {:d}", signature_id);
+            return false;
+        }
 
-        // Find the associated signature by id.
-        signature_statement->Bind(1, signature_id);
-        
-        if (auto signature_row = signature_statement->Step())
+        // The statements have to be released before the old table can be
+        // dropped.
         {
-            auto image_id = signature_row.GetInt64(0);
-            auto signature = signature_row.GetBlob(1);
+            auto select = conn_->Prepare(
+                "SELECT id, compressed_signature FROM signatures");
+            auto insert = conn_->Prepare(
+                "INSERT INTO words_migrated (word_key, signature_id) "
+                "VALUES(?, ?)");
+
+            if (!select || !insert)
+            {
+                console->error("Error when preparing statement: {}",
+                               conn_->GetErrorMessage());
+                conn_->Execute("ROLLBACK TRANSACTION");
+
+                return false;
+            }
 
-            // Find the associated image by id.
-            image_statement->Bind(1, image_id);
+            WordKeys keys;
 
-            if (auto image_row = image_statement->Step())
+            while (auto row = select->Step())
             {
-                auto digest = image_row.GetBlob(0);
-                auto filename = image_row.GetText(1);
-                auto uncompressed = Puzzle::CVecFromCompressedBuffer(
-                    puzzle_, signature.data(), signature.size());
-                auto distance = image.Compare(*uncompressed.get());
+                auto signature_id = row.GetInt64(0);
+                auto vec = UncompressSignature(row.GetBlob(1));
 
-                console->debug("Found matching image '{}'", filename.data());
+                if (!vec)
+                {
+                    console->warn("Skipping unreadable signature {:d}",
+                                  signature_id);
+                    continue;
+                }
 
-                if (distance < SimilarityThreshold)
+                WordIndex::MakeKeys(vec->data(), vec->size(), num_words_, keys);
+
+                for (auto key : keys)
                 {
-                    console->debug(
-                        "The images are similar! normalized distance: {}",
-                        distance);
+                    insert->Reset();
+                    insert->Bind(1, key);
+                    insert->Bind(2, signature_id);
+                    insert->Step();
+
+                    if (!insert->IsDone())
+                        throw SQLite3::SQLiteError(conn_->GetErrorMessage());
                 }
+
+                num_signatures++;
             }
 
-            image_statement->Reset();
+            if (!select->IsDone())
+                throw SQLite3::SQLiteError(conn_->GetErrorMessage());
         }
 
-        signature_statement->Reset();
+        if (conn_->Execute("DROP TABLE words") != SQLITE_OK ||
+            conn_->Execute("ALTER TABLE words_migrated RENAME TO words") !=
+                SQLITE_OK ||
+            conn_->Execute("DROP TABLE IF EXISTS word_frequencies") !=
+                SQLITE_OK ||
+            conn_->Execute(CreateWordFrequenciesSQL) != SQLITE_OK ||
+            conn_->Execute(CountWordFrequenciesSQL) != SQLITE_OK)
+            throw SQLite3::SQLiteError(conn_->GetErrorMessage());
+    }
+    catch (...)
+    {
+        conn_->Execute("ROLLBACK TRANSACTION");
+        throw;
+    }
+
+    conn_->Execute("END TRANSACTION");
+    legacy_words_ = false;
+
+    console->info("Migrated the words of {} signatures, compacting the "
+                  "database", num_signatures);
+
+    // Give the pages of the old table and its index back to the file system.
+    if (conn_->Execute("VACUUM") != SQLITE_OK)
+        console->warn("Failed to compact the database: {}",
+                      conn_->GetErrorMessage());
+
+    // An index file built from the old words can't be opened anymore.
+    if (access(index_file_path_.c_str(), F_OK) == 0)
+    {
+        console->info("Rebuilding the word index file");
+
+        return BuildIndexFile();
+    }
+
+    return true;
+}
+
+bool Context::OpenIndexFile()
+{
+    auto console = spdlog::get("console");
+    auto file = std::make_unique<IndexFile>();
+
+    if (!file->Open(index_file_path_))
+    {
+        index_file_.reset();
+
+        return false;
     }
+
+    console->debug("Opened index file '{}' with {} keys", index_file_path_,
+                   file->GetHeader().num_keys);
+
+    index_file_ = std::move(file);
+
+    return true;
 }
 
-void Context::Commit(const Image& image)
+bool Context::BuildIndexFile()
 {
     auto console = spdlog::get("console");
-    int image_id, signature_id;
+    auto conn = connections_->GetReader();
+
+    // Unmap the old file before it gets replaced.
+    index_file_.reset();
 
-    if ((image_id = SaveImage(image)) == -1)
+    if (!IndexFile::Build(index_file_path_, *conn))
     {
-        console->error("SaveImage returned -1");
-        return;
+        console->error("Failed to build index file '{}'", index_file_path_);
+
+        return false;
     }
 
-    if ((signature_id = SaveImageSignature(image, image_id)) == -1)
+    return OpenIndexFile();
+}
+
+void Context::SetNumThreads(size_t num_threads)
+{
+    if (num_threads == 0)
+        num_threads = std::thread::hardware_concurrency();
+
+    // Workers open a reader of their own when a task needs one, so close it
+    // before the thread exits.
+    auto connections = connections_;
+
+    if (num_threads > 1)
+        pool_ = std::make_unique<ThreadPool>(
+            num_threads, [connections] { connections->ReleaseReader(); });
+    else
+        pool_.reset();
+}
+
+void Context::ReleaseReader()
+{
+    connections_->ReleaseReader();
+}
+
+bool Context::LoadSignatureStore()
+{
+    auto console = spdlog::get("console");
+    auto conn = connections_->GetReader();
+    auto store = std::make_unique<SignatureStore>();
+
+    if (!store->Load(*conn))
     {
-        console->error("SaveImageSignature returned -1");
-        return;
+        console->error("Failed to load the signature store: {}",
+                       conn->GetErrorMessage());
+
+        return false;
     }
 
-    conn_->Execute("BEGIN TRANSACTION");
+    console->debug("Loaded {} signatures into the signature store",
+                   store->GetCount());
 
-    if (!SaveImageWords(image, image_id, signature_id))
+    store_ = std::move(store);
+
+    return true;
+}
+
+bool Context::LoadWordIndex()
+{
+    auto console = spdlog::get("console");
+    auto conn = connections_->GetReader();
+    auto index = std::make_unique<WordIndex>();
+
+    if (!index->Load(*conn))
     {
-        console->error("SaveImageWords failed");
+        console->error("Failed to load the word index: {}",
+                       conn->GetErrorMessage());
+
+        return false;
     }
 
-    conn_->Execute("END TRANSACTION");
+    console->debug("Loaded word index with {} keys and {} postings",
+                   index->GetNumKeys(), index->GetNumPostings());
+
+    index_ = std::move(index);
+
+    return true;
+}
+
+std::unique_ptr<Image> Context::OpenImage(const std::string& filename)
+{
+    return OpenImage(filename, puzzle_);
+}
+
+std::unique_ptr<Image>
+Context::OpenImage(const std::string& filename,
+                   std::shared_ptr<Puzzle::Context> puzzle)
+{
+    MappedFile file;
+
+    // The file is read once, and the same bytes are hashed and decoded.
+    if (!file.Open(filename))
+        throw Puzzle::BitmapLoadError("Could not load bitmap file");
+
+    return OpenImage(filename, file.GetData(), file.GetSize(), puzzle);
+}
+
+std::unique_ptr<Image>
+Context::OpenImage(const std::string& filename, const void* data, size_t size,
+                   std::shared_ptr<Puzzle::Context> puzzle)
+{
+    auto console = spdlog::get("console");
+    auto conn = connections_->GetReader();
+    auto digest = SHA256Digest(data, size);
+
+    auto statement = conn->Prepare(
+        "SELECT images.id, signatures.compressed_signature FROM images "
+        "INNER JOIN signatures ON signatures.image_id = images.id "
+        "WHERE images.digest = ? LIMIT 1");
+
+    if (!statement)
+    {
+        console->error("Error when preparing statement: {}",
+                       conn->GetErrorMessage());
+    }
+    else
+    {
+        statement->Bind(1, digest.data(), digest.size());
+
+        if (auto row = statement->Step())
+        {
+            auto signature = row.GetBlob(1);
+            auto cvec = Puzzle::CVecFromCompressedBuffer(
+                puzzle, signature.data(), signature.size());
+
+            if (cvec)
+            {
+                console->debug("'{}' is identical to image {:d}", filename,
+                               row.GetInt64(0));
+
+                auto image = std::make_unique<Image>(
+                    shared_from_this(), filename, std::move(cvec));
+
+                image->SetDigest(digest);
+                image->SetID(row.GetInt64(0));
+
+                return image;
+            }
+        }
+    }
+
+    auto image = std::make_unique<Image>(
+        shared_from_this(), filename,
+        std::make_unique<Puzzle::CVec>(puzzle, data, size));
+
+    image->SetDigest(digest);
+
+    return image;
+}
+
+int64_t Context::Commit(const Image& image)
+{
+    return CommitBatch({ &image })[0];
+}
+
+std::vector<int64_t>
+Context::CommitBatch(const std::vector<const Image*>& images)
+{
+    auto console = spdlog::get("console");
+    std::vector<int64_t> result(images.size(), -1);
+    std::unordered_map<std::string, int64_t> digests;
+
+    auto image_statement = conn_->Prepare(InsertImageSQL);
+    auto signature_statement = conn_->Prepare(InsertSignatureSQL);
+    auto words_statement = conn_->Prepare(InsertWordSQL);
+    auto frequency_statement = conn_->Prepare(UpdateWordFrequencySQL);
+
+    if (!image_statement || !signature_statement || !words_statement ||
+        !frequency_statement)
+    {
+        console->error("Error when preparing statement: {}",
+                       conn_->GetErrorMessage());
+        return result;
+    }
+
+    // The in-memory signature store and word index are only updated once the
+    // transaction has been committed, so a rollback cannot leave them ahead
+    // of the database.
+    std::vector<std::pair<size_t, int64_t>> added;
+
+    if (conn_->Execute("BEGIN TRANSACTION") != SQLITE_OK)
+    {
+        console->error("Failed to begin transaction: {}",
+                       conn_->GetErrorMessage());
+        return result;
+    }
+
+    // Each image is saved under a savepoint of its own, so an image that
+    // fails halfway leaves none of its rows behind.
+    auto discard = [this]
+    {
+        conn_->Execute("ROLLBACK TO img");
+        conn_->Execute("RELEASE img");
+    };
+
+    try
+    {
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            auto& image = *images[i];
+            int image_id, signature_id;
+
+            if (image.IsCommitted())
+            {
+                console->info(
+                    "Image '{}' has already been committed as image {:d}",
+                    image.GetFileName(), image.GetID());
+
+                result[i] = image.GetID();
+                continue;
+            }
+
+            // Byte-identical files within the batch are only inserted once.
+            auto duplicate = digests.find(image.GetDigest());
+
+            if (duplicate != digests.end())
+            {
+                console->info("Image '{}' is identical to image {:d}",
+                              image.GetFileName(), duplicate->second);
+
+                result[i] = duplicate->second;
+                continue;
+            }
+
+            if (conn_->Execute("SAVEPOINT img") != SQLITE_OK)
+            {
+                console->error("Failed to create savepoint: {}",
+                               conn_->GetErrorMessage());
+                continue;
+            }
+
+            if ((image_id = SaveImage(image, *image_statement)) == -1)
+            {
+                console->error("SaveImage returned -1");
+                discard();
+                continue;
+            }
+
+            if ((signature_id = SaveImageSignature(image, image_id,
+                                                   *signature_statement)) == -1)
+            {
+                console->error("SaveImageSignature returned -1");
+                discard();
+                continue;
+            }
+
+            if (!SaveImageWords(image, image_id, signature_id,
+                                *words_statement, *frequency_statement))
+            {
+                console->error("SaveImageWords failed");
+                discard();
+                continue;
+            }
+
+            conn_->Execute("RELEASE img");
+
+            if (!image.GetDigest().empty())
+                digests.emplace(image.GetDigest(), image_id);
+
+            added.emplace_back(i, signature_id);
+            result[i] = image_id;
+        }
+    }
+    catch (...)
+    {
+        conn_->Execute("ROLLBACK TRANSACTION");
+        throw;
+    }
+
+    if (conn_->Execute("END TRANSACTION") != SQLITE_OK)
+    {
+        console->error("Failed to commit transaction: {}",
+                       conn_->GetErrorMessage());
+        conn_->Execute("ROLLBACK TRANSACTION");
+
+        for (auto& addition : added)
+            result[addition.first] = -1;
+
+        return result;
+    }
+
+    for (auto& addition : added)
+        AddToMemory(*images[addition.first], result[addition.first],
+                    addition.second);
+
+    if (num_signatures_ >= 0)
+        num_signatures_ += added.size();
+
+    return result;
+}
+
+void Context::AddToMemory(const Image& image, int64_t image_id,
+                          int64_t signature_id)
+{
+    if (store_)
+    {
+        auto cvec = image.GetCvec();
+
+        store_->Add(signature_id, image_id, cvec->GetVec(), cvec->GetSize());
+    }
+
+    if (index_)
+    {
+        WordKeys keys;
+
+        image.GetWordKeys(keys);
+
+        for (auto key : keys)
+            index_->Insert(key, signature_id);
+    }
 }
 
 int Context::SaveImage(const Image& image)
+{
+    auto statement = conn_->Prepare(InsertImageSQL);
+
+    if (!statement)
+        return -1;
+
+    return SaveImage(image, *statement);
+}
+
+int Context::SaveImage(const Image& image, SQLite3::Statement& statement)
 {
     auto console = spdlog::get("console");
 
     try
     {
-        auto statement = conn_->Prepare(
-            "INSERT INTO images (filename, digest) VALUES (?, ?)");
+        auto digest = image.GetDigest();
 
-        auto digest = SHA256File(image.GetFileName());
+        if (digest.empty())
+            digest = SHA256File(image.GetFileName());
 
-        statement->Bind(1, image.GetFileName()); // filename
-        statement->Bind(2, digest.data(), digest.size()); // digest
-        statement->Step();
+        statement.Reset();
+        statement.Bind(1, image.GetFileName()); // filename
+        statement.Bind(2, digest.data(), digest.size()); // digest
+        statement.Step();
 
-        if (!statement->IsDone())
+        if (!statement.IsDone())
         {
             console->trace("SQL Step failed: {}", conn_->GetErrorMessage());
 
@@ -180,20 +1828,38 @@ int Context::SaveImage(const Image& image)
 }
 
 int Context::SaveImageSignature(const Image& image, int image_id)
+{
+    auto statement = conn_->Prepare(InsertSignatureSQL);
+
+    if (!statement)
+        return -1;
+
+    return SaveImageSignature(image, image_id, *statement);
+}
+
+int Context::SaveImageSignature(const Image& image, int image_id,
+                                SQLite3::Statement& statement)
 {
     try
     {
-        auto statement = conn_->Prepare("INSERT INTO signatures (image_id, "
-                                   "compressed_signature) VALUES(?, ?)");
+        auto signature = image.GetCompressedSignature();
+        auto& sketch = image.GetSketch();
 
-        auto cvec = image.GetCvec();
-        auto compressed = cvec->Compress();
+        if (signature.empty())
+        {
+            auto compressed = image.GetCvec()->Compress();
 
-        statement->Bind(1, image_id);
-        statement->Bind(2, compressed->GetVec(), compressed->GetSize());
-        statement->Step();
+            signature.assign(reinterpret_cast<char*>(compressed->GetVec()),
+                             compressed->GetSize());
+        }
+
+        statement.Reset();
+        statement.Bind(1, image_id);
+        statement.Bind(2, signature.data(), signature.size());
+        statement.Bind(3, sketch.data(), sketch.size() * sizeof(uint64_t));
+        statement.Step();
 
-        if (!statement->IsDone())
+        if (!statement.IsDone())
         {
             return -1;
         }
@@ -207,84 +1873,73 @@ int Context::SaveImageSignature(const Image& image, int image_id)
 }
 
 bool Context::SaveImageWords(const Image& image, int image_id, int signature_id)
+{
+    auto statement = conn_->Prepare(InsertWordSQL);
+    auto frequency = conn_->Prepare(UpdateWordFrequencySQL);
+
+    if (!statement || !frequency)
+        return false;
+
+    return SaveImageWords(image, image_id, signature_id, *statement,
+                          *frequency);
+}
+
+bool Context::SaveImageWords(const Image& image, int image_id, int signature_id,
+                             SQLite3::Statement& statement,
+                             SQLite3::Statement& frequency)
 {
     (void)image_id;
     auto console = spdlog::get("console");
-    auto statement = conn_->Prepare(
-        "INSERT INTO words (signature_id, pos_and_word) VALUES(?, ?)");
+    WordKeys keys;
 
-    auto words = CompressWords(image.GetWords());
+    image.GetWordKeys(keys);
 
-    for (auto word : words)
+    for (auto key : keys)
     {
-        statement->Reset();
-        statement->Bind(1, signature_id);
-        statement->Bind(2, word.data(), word.size());
-        statement->Step();
+        statement.Reset();
+        statement.Bind(1, key);
+        statement.Bind(2, signature_id);
+        statement.Step();
 
-        if (!statement->IsDone())
+        if (!statement.IsDone())
         {
             console->error("Failed to insert word: {}",
                            conn_->GetErrorMessage());
+            return false;
         }
-    }
-
-    return true;
-}
-
-using StringVector = std::vector<std::string>;
-StringVector Context::CompressWords(const StringVector& words) const
-{
-    Puzzle::CVec cvec(puzzle_);
-    std::vector<std::string> result;
 
-    result.reserve(words.size());
+        frequency.Reset();
+        frequency.Bind(1, key);
+        frequency.Step();
 
-    for (auto word : words)
-    {
-        cvec.SetVec(word);
-        auto compr_cvec = cvec.Compress();
-
-        result.emplace_back(reinterpret_cast<char*>(compr_cvec->GetVec()),
-                            compr_cvec->GetSize());
+        if (!frequency.IsDone())
+        {
+            console->error("Failed to count word: {}",
+                           conn_->GetErrorMessage());
+            return false;
+        }
     }
 
-    // Avoid having the destructor free the vector buffer seeing as we don't
-    // have ownership of it.
-    cvec.SetVec(nullptr, 0);
-
-    return result;
+    return true;
 }
 
 std::string Context::SHA256File(const std::string& path) const
 {
-    std::ifstream file(path);
-    const int buffer_size = 4096;
-    char digest[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
+    MappedFile file;
 
-    if (!file.good())
-        return nullptr;
+    if (!file.Open(path))
+        return std::string();
 
     spdlog::get("console")->debug("Generating digest for file '{}'", path);
 
-    auto buffer = new char[buffer_size];
-
-    SHA256_Init(&sha256);
-
-    // Begin digesting bits of the file.
-    while (!file.eof())
-    {
-        file.read(buffer, buffer_size);
-
-        if (file.bad())
-            throw RuntimeError("Read error when trying to generate digest");
+    return SHA256Digest(file.GetData(), file.GetSize());
+}
 
-        SHA256_Update(&sha256, buffer, file.gcount());
-    }
+std::string Context::SHA256Digest(const void* data, size_t size)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
 
-    delete[] buffer;
-    SHA256_Final(reinterpret_cast<unsigned char*>(digest), &sha256);
+    SHA256(static_cast<const unsigned char*>(data), size, digest);
 
-    return { digest, sizeof digest };
+    return { reinterpret_cast<char*>(digest), sizeof digest };
 }
@@ -20,17 +20,29 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <algorithm>
+#include <unordered_map>
+#include <chrono>
 
 #include "OFN/Puzzle.h"
+#include "OFN/TopK.h"
+#include "OFN/SQLite3/ConnectionOptions.h"
+#include "OFN/WordIndex.h"
+#include "OFN/SignatureCache.h"
+#include "OFN/QueryPlanner.h"
+
+namespace OFN
+{
 
 namespace SQLite3
 {
 class Connection;
+class ConnectionPool;
+class Data;
+class Row;
+class Statement;
 }
 
-namespace OFN
-{
-
 class RuntimeError : public std::runtime_error
 {
 public:
@@ -43,19 +55,125 @@ public:
     TransactionError(const std::string& what_arg) : RuntimeError(what_arg) {}
 };
 
+/**
+ * A similar image found by a search.
+ */
+struct Match
+{
+    /** The image id. */
+    int64_t image_id;
+
+    /** The id of the matching signature. */
+    int64_t signature_id;
+
+    /** The filename the image was committed with. */
+    std::string filename;
+
+    /** The raw SHA256 digest of the image file. */
+    std::string digest;
+
+    /** The normalized distance to the query. */
+    double distance;
+
+    /**
+     * Order matches by ascending distance.
+     */
+    bool operator<(const Match& other) const
+    {
+        return distance < other.distance;
+    }
+};
+
+using MatchVector = std::vector<Match>;
+
+/** A distance paired with a signature store row index. */
+using ScoredRow = std::pair<double, size_t>;
+
+/** The indices of the queries that contain each word key. */
+using KeyListeners = std::unordered_map<WordKey, std::vector<uint32_t>>;
+
+/**
+ * Counters collected during a search.
+ */
+struct SearchStats
+{
+    /** The number of candidate signatures considered. */
+    size_t candidates = 0;
+
+    /** The number of candidates rejected by their sketch alone. */
+    size_t prefiltered = 0;
+
+    /** The number of query words ignored for being too common. */
+    size_t stopped_words = 0;
+
+    /** The number of postings read while voting. */
+    size_t postings = 0;
+
+    /** The number of candidates looked up by signature id. */
+    size_t fetches = 0;
+
+    /** The number of rows read by a sequential scan. */
+    size_t rows_read = 0;
+
+    /** The plan chosen for the search and its estimated costs. */
+    PlanEstimate plan;
+};
+
+/**
+ * How much the candidate selection controls narrow down a query.
+ */
+struct CandidateReport
+{
+    /** The number of words in the query. */
+    size_t words = 0;
+
+    /** The number of words ignored for being too common. */
+    size_t stopped_words = 0;
+
+    /** The number of signatures sharing at least one word with the query. */
+    size_t candidates = 0;
+
+    /** The number of candidates left by the stoplist and minimum votes. */
+    size_t selected = 0;
+};
+
 /* Forward declarations. */
 class Image;
+class IndexFile;
+class SignatureStore;
+class ThreadPool;
 
 /**
  * %Context class.
  */
-class Context
+class Context : public std::enable_shared_from_this<Context>
 {
 public:
+    /** The default path of the database. */
+    static constexpr const char* DefaultDatabasePath = "ofn.db";
+
     /**
      * Constructor.
+     *
+     * @param path    the path of the database
+     * @param options the settings to open the database with
+     *
+     * @throws SQLite3::ConnectionError if the database cannot be opened or
+     * configured.
+     */
+    Context(const std::string& path = DefaultDatabasePath,
+            const SQLite3::ConnectionOptions& options = {});
+
+    /**
+     * Construct a context on a shared connection pool.
+     *
+     * Reads go through the read-only connection of the calling thread, so
+     * threads that each have their own context can search in parallel while
+     * one of them commits.
+     *
+     * @param connections the connection pool of the database
      */
-    Context();
+    Context(std::shared_ptr<SQLite3::ConnectionPool> connections);
 
     /**
      * Destructor.
@@ -65,15 +183,253 @@ public:
 public:
     using StringVector = std::vector<std::string>;
 
+    /**
+     * Open an image, reusing the stored signature of a byte-identical file.
+     *
+     * The digest of the file is computed and looked up first. If an image
+     * with the same digest has been committed, its signature is taken from
+     * the database and the file is never decoded.
+     *
+     * @param filename the image filename
+     *
+     * @returns the image, with its digest set and with its id set if it has
+     * already been committed.
+     */
+    std::unique_ptr<Image> OpenImage(const std::string& filename);
+
+    /**
+     * Open an image using a specific puzzle context.
+     *
+     * Puzzle contexts are not thread-safe, so threads opening images
+     * concurrently each pass their own.
+     */
+    std::unique_ptr<Image> OpenImage(const std::string& filename,
+                                     std::shared_ptr<Puzzle::Context> puzzle);
+
+    /**
+     * Open an image from an encoded image in memory.
+     *
+     * @param filename the name to commit the image with
+     * @param data     the encoded image
+     * @param size     the size of the encoded image in bytes
+     * @param puzzle   the puzzle context to decode with
+     */
+    std::unique_ptr<Image> OpenImage(const std::string& filename,
+                                     const void* data, size_t size,
+                                     std::shared_ptr<Puzzle::Context> puzzle);
+
     /**
      * Commit a new image and its fingerprint to the database.
+     *
+     * Images that have already been committed are not inserted again.
+     *
+     * @returns the id of the image on success, -1 otherwise.
      */
-    void Commit(const Image& image);
+    int64_t Commit(const Image& image);
+
+    /**
+     * Commit several images and their fingerprints in a single transaction.
+     *
+     * The image, signature and word INSERT statements are prepared once and
+     * reused for every image. Images that have already been committed, or
+     * whose digest occurs earlier in the batch, are not inserted again.
+     *
+     * @param images the images to commit
+     *
+     * @returns the id of each image, or -1 where it failed, in the order of
+     * `images`.
+     */
+    std::vector<int64_t> CommitBatch(const std::vector<const Image*>& images);
 
     /**
      * Search for similar images in the database.
+     *
+     * @param image     the image to search for
+     * @param k         the maximum number of matches to return
+     * @param threshold only matches closer than this distance are returned
+     *
+     * @returns the closest matches, best first.
+     *
+     * If the signature store has been loaded, every signature is scored.
+     * Otherwise candidates are taken from the in-memory word index if it has
+     * been loaded, then from the index file if there is one, and from the
+     * `words` table otherwise. Candidates are scored in descending vote order
+     * and the scan only stops early once the matches are all exact
+     * duplicates.
+     */
+    MatchVector Search(const Image& image, size_t k, double threshold);
+
+    /**
+     * Search for images similar to any of several images in one pass.
+     *
+     * Every distinct word of the batch is looked up once, and every candidate
+     * signature is read once and scored against all of the images that ranked
+     * it. With the signature store loaded, every row is scored against all
+     * images while it is in cache.
+     *
+     * Both paths use the same sketch prefilter and stopping rule as Search,
+     * but score candidates in a different order. The matches are therefore
+     * the same as those of Search only up to ties: among candidates at the
+     * same distance a different one may be kept, and on the word path the
+     * candidates that tie on votes at the candidate limit may differ.
+     *
+     * @param images    the images to search for
+     * @param k         the maximum number of matches per image
+     * @param threshold only matches closer than this distance are returned
+     *
+     * @returns the closest matches of each image, in the order of `images`.
+     */
+    std::vector<MatchVector>
+    SearchBatch(const std::vector<const Image*>& images, size_t k,
+                double threshold);
+
+    /**
+     * @brief Build the in-memory word index from the `words` table.
+     *
+     * Once loaded, the index is used by Search and kept up to date by Commit.
+     *
+     * @returns true on success, false otherwise.
+     */
+    bool LoadWordIndex();
+
+    /**
+     * @brief Set the number of words taken from each signature.
+     *
+     * More words find more candidates at the cost of larger queries. Images
+     * should be searched with the same number of words they were committed
+     * with.
+     *
+     * @param num_words the number of words, at most WordKeys::Capacity
+     */
+    void SetNumWords(size_t num_words)
+    {
+        num_words_ = std::min(num_words, WordKeys::Capacity);
+    }
+
+    /**
+     * @brief Get the number of words taken from each signature.
+     */
+    size_t GetNumWords() const
+    {
+        return num_words_;
+    }
+
+    /**
+     * @brief Set the number of words a signature has to share with the query
+     * before it is scored.
+     *
+     * Only searches that look up candidates by word are affected; a scan or
+     * a search of the signature store scores every signature.
+     */
+    void SetMinVotes(int min_votes)
+    {
+        min_votes_ = std::max(min_votes, 1);
+    }
+
+    /**
+     * @brief Get the number of words a candidate has to share with the query.
+     */
+    int GetMinVotes() const
+    {
+        return min_votes_;
+    }
+
+    /**
+     * @brief Set the stoplist cutoff.
+     *
+     * Words found in more than this fraction of all signatures, such as those
+     * of flat backgrounds and solid borders, are ignored when looking up
+     * candidates. Like the minimum number of votes, it has no effect on
+     * searches that score every signature.
+     *
+     * @param fraction the document frequency cutoff, 1 or more to disable the
+     *                 stoplist
+     */
+    void SetMaxWordFrequency(double fraction)
+    {
+        max_word_frequency_ = fraction;
+    }
+
+    /**
+     * @brief Get the stoplist cutoff.
+     */
+    double GetMaxWordFrequency() const
+    {
+        return max_word_frequency_;
+    }
+
+    /**
+     * @brief Set the costs the query planner weighs the search plans by.
+     */
+    void SetCostModel(const CostModel& model)
+    {
+        planner_ = QueryPlanner(model);
+    }
+
+    /**
+     * @brief Count the candidates of an image with and without the stoplist
+     * and minimum votes applied.
+     *
+     * Every candidate is counted, not just the MaxCandidates best.
+     */
+    CandidateReport ReportCandidates(const Image& image);
+
+    /**
+     * @brief Set the memory budget of the signature cache.
+     *
+     * Search looks up candidates in the cache before reading them from the
+     * database, and caches the ones it had to read.
+     *
+     * @param budget the approximate number of bytes to use, or 0 to disable
+     *               the cache
+     */
+    void SetSignatureCacheSize(size_t budget);
+
+    /**
+     * @brief Get the statistics of the signature cache.
+     *
+     * @returns the statistics, all zero if the cache is disabled.
+     */
+    SignatureCacheStats GetSignatureCacheStats() const;
+
+    /**
+     * @brief Set the number of threads used to scan the signature store.
+     *
+     * @param num_threads the number of threads, or 0 to use every core
+     */
+    void SetNumThreads(size_t num_threads);
+
+    /**
+     * @brief Close the read-only connection of the calling thread.
+     *
+     * Threads that used the context and are about to exit should call this so
+     * that their connection does not stay open.
      */
-    void Search(const Image& image);
+    void ReleaseReader();
+
+    /**
+     * @brief Load every signature into the in-memory signature store.
+     *
+     * Once loaded, Search does an exact scan over the store instead of
+     * looking up candidates by word, and Commit appends to it.
+     *
+     * @returns true on success, false otherwise.
+     */
+    bool LoadSignatureStore();
+
+    /**
+     * @brief Map the word index file into memory if it exists.
+     *
+     * @returns true if the index file was opened, false otherwise.
+     */
+    bool OpenIndexFile();
+
+    /**
+     * @brief Rebuild the word index file from the database and open it.
+     *
+     * @returns true on success, false otherwise.
+     */
+    bool BuildIndexFile();
 
     /**
      * @brief Save the image to the database.
@@ -82,6 +438,11 @@ public:
      */
     int SaveImage(const Image& image);
 
+    /**
+     * @brief Save the image to the database with a prepared INSERT statement.
+     */
+    int SaveImage(const Image& image, SQLite3::Statement& statement);
+
     /**
      * @brief Save the image signature to the database.
      *
@@ -89,16 +450,56 @@ public:
      */
     int SaveImageSignature(const Image& image, int image_id);
 
+    /**
+     * @brief Save the image signature with a prepared INSERT statement.
+     */
+    int SaveImageSignature(const Image& image, int image_id,
+                           SQLite3::Statement& statement);
+
+    /**
+     * @brief Add a committed image to the signature store and the word index,
+     * if they have been loaded.
+     */
+    void AddToMemory(const Image& image, int64_t image_id,
+                     int64_t signature_id);
+
     /**
      * @brief Save the image words compressed to the database.
      */
     bool SaveImageWords(const Image& image, int image_id, int signature_id);
 
     /**
-     * @brief Compress a list of words using PuzzleCompressedCvec.
+     * @brief Save the image words with a prepared INSERT statement.
+     *
+     * @param frequency the prepared statement that counts each word towards
+     *                  its document frequency
      */
-    std::vector<std::string> CompressWords(const StringVector& words) const;
+    bool SaveImageWords(const Image& image, int image_id, int signature_id,
+                        SQLite3::Statement& statement,
+                        SQLite3::Statement& frequency);
 
+    /**
+     * @brief Check whether the `words` table still uses the old layout of
+     * compressed `pos_and_word` blobs.
+     *
+     * Such a database has to be converted with MigrateWords before it can
+     * be searched or committed to.
+     */
+    bool HasLegacyWords() const
+    {
+        return legacy_words_;
+    }
+
+    /**
+     * @brief Convert the `words` table to integer word keys.
+     *
+     * The keys are computed from the stored signatures with the current
+     * number of words, and the table is replaced in a single transaction.
+     * The index file is rebuilt afterwards if there is one.
+     *
+     * @returns true on success, false otherwise.
+     */
+    bool MigrateWords();
 
 public:
     /* Getters */
@@ -107,7 +508,206 @@ public:
         return puzzle_;
     }
 
+    const SearchStats& GetLastSearchStats() const
+    {
+        return stats_;
+    }
+
 protected:
+    /**
+     * @brief Add columns introduced after the database was created, and
+     * detect a `words` table that needs to be migrated.
+     */
+    void UpgradeSchema();
+
+    /**
+     * @brief Search by scoring every signature in the signature store.
+     *
+     * The store is split into chunks that are scored across the thread pool,
+     * each worker keeping its own top matches until they are merged.
+     */
+    void SearchExact(const Image& image, double threshold,
+                     TopK<Match>& matches);
+
+    /**
+     * @brief Look up the images of the best store rows and add them as
+     * matches.
+     *
+     * @param rows the distances and row indices of the best rows
+     */
+    void AddStoreMatches(TopK<ScoredRow>& rows, TopK<Match>& matches);
+
+    /**
+     * @brief Batch search by scoring every signature in the store.
+     */
+    void SearchExactBatch(const std::vector<const Image*>& images,
+                          double threshold, std::vector<TopK<Match>>& matches);
+
+    /**
+     * @brief Batch search using the word indexes or the `words` table.
+     */
+    void SearchWordsBatch(const std::vector<const Image*>& images,
+                          double threshold, std::vector<TopK<Match>>& matches);
+
+    /**
+     * @brief Search using a vote-ranked query on the `words` table.
+     *
+     * @param keys the word keys of the query, without stop words
+     */
+    void SearchDatabase(const Image& image, const WordKeys& keys,
+                        double threshold, TopK<Match>& matches);
+
+    /**
+     * @brief Search using the in-memory word index or the index file.
+     *
+     * @param keys the word keys of the query, without stop words
+     */
+    void SearchIndex(const Image& image, const WordKeys& keys,
+                     double threshold, TopK<Match>& matches);
+
+    /**
+     * @brief Search by reading every signature in the `signatures` table in
+     * order.
+     *
+     * Scanned signatures are not added to the signature cache. Every
+     * signature is scored, so neither the minimum number of votes nor the
+     * stoplist applies.
+     *
+     * @param matches the top matches of each query, in the order of images
+     */
+    void ScanSignatures(const std::vector<const Image*>& images,
+                        double threshold, TopK<Match>* matches);
+
+    /**
+     * @brief Choose between looking up candidates by word and scanning every
+     * signature.
+     *
+     * The chosen plan and its estimate are kept in the search stats.
+     *
+     * @param listeners   the word keys of the queries, without stop words
+     * @param num_queries the number of queries
+     */
+    const PlanEstimate& PlanSearch(const KeyListeners& listeners,
+                                   size_t num_queries);
+
+    /**
+     * @brief Get the number of signatures listed under each word key.
+     *
+     * @param frequencies the frequencies to fill in, keyed by word key; keys
+     *                    that aren't listed are left out
+     *
+     * @returns true on success, false otherwise.
+     */
+    bool GetWordFrequencies(const KeyListeners& listeners,
+                            std::unordered_map<WordKey, size_t>& frequencies);
+
+    /**
+     * @brief Log the chosen plan against the cost of the work that was
+     * actually done.
+     *
+     * @param start when the search began
+     */
+    void LogPlan(std::chrono::steady_clock::time_point start) const;
+
+    /**
+     * @brief Count shared words for signatures newer than a given id.
+     *
+     * @param keys         the word keys of the query
+     * @param signature_id only signatures with a greater id are counted
+     * @param votes        the vote counts to add to, keyed by signature id
+     *
+     * @returns true on success, false otherwise.
+     */
+    bool VoteRecentWords(const WordKeys& keys,
+                         int64_t signature_id,
+                         std::unordered_map<uint32_t, int>& votes);
+
+    /**
+     * @brief Drop the words that are above the stoplist cutoff.
+     *
+     * The remaining keys are moved to the front of the array, in no
+     * particular order.
+     *
+     * @param keys  the word keys of the query
+     * @param count the number of keys
+     *
+     * @returns the number of keys left.
+     */
+    size_t RemoveStopWords(WordKey* keys, size_t count);
+
+    /**
+     * @brief Get the number of signatures in the database.
+     */
+    int64_t GetNumSignatures();
+
+    /**
+     * @brief Compute the distance to a candidate and keep it if it matches.
+     *
+     * Candidates whose sketch proves they cannot beat the threshold or the
+     * current matches are rejected without looking at their signature. The
+     * others are scored straight from their compressed signature.
+     *
+     * @param row the candidate row, with the compressed signature, image id,
+     *            digest, filename and sketch as its first five columns
+     */
+    void ScoreCandidate(const Image& image, const Candidate& candidate,
+                        const SQLite3::Row& row, double threshold,
+                        TopK<Match>& matches);
+
+    /**
+     * @brief Compute the distance from a row to each of a number of queries
+     * and keep it wherever it matches.
+     *
+     * The signature is scored straight from its compressed form, against
+     * every query whose sketch doesn't already rule it out.
+     *
+     * @param queries the indices into images and matches of the queries
+     * @param row     the row, laid out as for ScoreCandidate
+     */
+    void ScoreRow(const std::vector<const Image*>& images,
+                  const std::vector<uint32_t>& queries, int64_t signature_id,
+                  const SQLite3::Row& row, double threshold,
+                  TopK<Match>* matches);
+
+    /**
+     * @brief Compute the distance to a cached candidate and keep it if it
+     * matches.
+     */
+    void ScoreSignature(const Image& image, const Candidate& candidate,
+                        const CachedSignature& signature, double threshold,
+                        TopK<Match>& matches);
+
+    /**
+     * @brief Look up a signature in the signature cache.
+     *
+     * @returns the cached signature, or nullptr if it isn't cached or the
+     * cache is disabled.
+     */
+    SignatureCache::Entry FindCachedSignature(int64_t signature_id);
+
+    /**
+     * @brief Add a candidate row to the signature cache.
+     *
+     * @param row the candidate row, laid out as for ScoreCandidate
+     *
+     * @returns the cached signature, or nullptr if it is malformed.
+     */
+    SignatureCache::Entry CacheSignature(int64_t signature_id,
+                                         const SQLite3::Row& row);
+
+    /**
+     * @brief Check whether a candidate's sketch rules it out.
+     *
+     * @param sketch the stored sketch of the candidate, possibly empty
+     * @param cutoff the distance the candidate has to beat
+     * @param length set to the squared length of the candidate, or
+     *               Puzzle::UnknownLength if it has no sketch
+     *
+     * @returns true if the candidate cannot beat the cutoff.
+     */
+    bool RejectBySketch(const Image& image, const SQLite3::Data& sketch,
+                        double cutoff, uint64_t& length);
+
     /**
      * @brief Compute a SHA256 hash for a given file.
      *
@@ -117,9 +717,31 @@ protected:
      */
     std::string SHA256File(const std::string& file) const;
 
+    /**
+     * @brief Compute a SHA256 hash for a buffer.
+     *
+     * @returns the hash as a string, but in raw form.
+     */
+    static std::string SHA256Digest(const void* data, size_t size);
+
 private:
+    std::shared_ptr<SQLite3::ConnectionPool> connections_;
     std::shared_ptr<SQLite3::Connection> conn_;
     std::shared_ptr<Puzzle::Context> puzzle_;
+    std::unique_ptr<WordIndex> index_;
+    std::unique_ptr<IndexFile> index_file_;
+    std::unique_ptr<SignatureStore> store_;
+    std::unique_ptr<SignatureCache> signature_cache_;
+    std::unique_ptr<ThreadPool> pool_;
+    QueryPlanner planner_;
+    std::string index_file_path_;
+    size_t num_words_;
+    int min_votes_;
+    double max_word_frequency_;
+    int64_t num_signatures_;
+    bool legacy_words_;
+    std::vector<uint64_t> sketch_buffer_;
+    SearchStats stats_;
 };
 
 }
@@ -16,8 +16,8 @@
  */
 
 #include <cstddef>
-#include <cassert>
 #include <cstring>
+#include <algorithm>
 
 #include "OFN/Puzzle.h"
 #include "OFN/Image.h"
@@ -27,9 +27,24 @@ using namespace OFN;
 
 Image::Image(std::shared_ptr<Context> context, const std::string& filename) :
     context_(context),
-    file_name_(filename)
+    file_name_(filename),
+    id_(-1)
 {
     cvec_ = new Puzzle::CVec(context->GetPuzzleContext(), filename);
+
+    ComputeSketch();
+    SplitCvec();
+}
+
+Image::Image(std::shared_ptr<Context> context, const std::string& filename,
+             std::unique_ptr<Puzzle::CVec> cvec) :
+    context_(context),
+    file_name_(filename),
+    cvec_(cvec.release()),
+    id_(-1)
+{
+    ComputeSketch();
+    SplitCvec();
 }
 
 Image::~Image()
@@ -37,23 +52,29 @@ Image::~Image()
     delete cvec_;
 }
 
-std::vector<std::string> Image::GetWords() const
+void Image::GetWordKeys(WordKeys& keys) const
 {
-    std::vector<std::string> words;
-    words.reserve(MAX_WORDS);
-
-    assert(cvec_->GetSize() > static_cast<size_t>(MAX_WORDS + MAX_WORD_LENGTH));
+    WordIndex::MakeKeys(cvec_->GetVec(), cvec_->GetSize(),
+                        context_->GetNumWords(), keys);
+}
 
-    for (int i = 0; i < MAX_WORDS; i++)
-    {
-        words.push_back(std::string(
-            reinterpret_cast<char*>(&cvec_->GetVec()[i]), MAX_WORD_LENGTH));
-    }
+void Image::ComputeSketch()
+{
+    sketch_.resize(Puzzle::GetSketchWords(cvec_->GetSize()));
+    Puzzle::ComputeSketch(cvec_->GetVec(), cvec_->GetSize(), sketch_.data());
+}
 
-    return words;
+void Image::SplitCvec()
+{
+    split_.resize(3 * Puzzle::GetSplitPlaneSize(cvec_->GetSize()));
+    Puzzle::SplitVector(cvec_->GetVec(), cvec_->GetSize(), split_.data());
 }
 
-double Image::Compare(const Puzzle::CVec& cvec) const
+bool Image::CompareCompressed(const void* data, size_t size, double cutoff,
+                              double& distance, uint64_t length) const
 {
-    return cvec_->GetDistance(cvec);
+    return Puzzle::NormalizedDistanceCompressed(split_.data(),
+                                                cvec_->GetSize(), data, size,
+                                                cutoff, distance, sketch_[0],
+                                                length);
 }
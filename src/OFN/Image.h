@@ -20,8 +20,10 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <cstdint>
 
 #include "OFN/Puzzle.h"
+#include "OFN/WordIndex.h"
 
 namespace OFN
 {
@@ -34,8 +36,8 @@ class Context;
 class Image
 {
 public:
-    static const int MAX_WORDS = 100;
-    static const int MAX_WORD_LENGTH = 10;
+    /** The default number of words taken from a signature. */
+    static const int DEFAULT_WORDS = 100;
 
 public:
     /**
@@ -46,25 +48,50 @@ public:
      */
     Image(std::shared_ptr<Context> context, const std::string& filename);
 
+    /**
+     * Constructor for an image whose cvec is already known, such as one that
+     * has been committed before.
+     *
+     * @param context The OFN context.
+     * @param filename The image filename.
+     * @param cvec The signature of the image.
+     */
+    Image(std::shared_ptr<Context> context, const std::string& filename,
+          std::unique_ptr<Puzzle::CVec> cvec);
+
     /**
      * Destructor.
      */
     ~Image();
 
     /**
-     * Compare this image with a vector.
+     * Compare this image with a compressed vector without uncompressing it
+     * first, giving up once the distance provably reaches a cutoff.
      *
-     * @param cvec the vector to compare with
+     * @param data     the compressed vector
+     * @param size     the size of the compressed vector in bytes
+     * @param cutoff   the distance the vector has to stay under
+     * @param distance set to the normalized distance, or a lower bound of at
+     *                 least the cutoff
+     * @param length   the squared length of the vector as stored in its
+     *                 sketch, or Puzzle::UnknownLength
      *
-     * @returns the normalized distance between this images vector and the input
-     * vector.
+     * @returns true on success, false if the compressed vector is malformed or
+     * of a different size.
      */
-    double Compare(const Puzzle::CVec& cvec) const;
+    bool CompareCompressed(const void* data, size_t size, double cutoff,
+                           double& distance,
+                           uint64_t length = Puzzle::UnknownLength) const;
 
     /**
-     * Get a list of words from the signature.
+     * Get the word keys of the signature.
+     *
+     * The number of words is set by the context, and is limited by the size
+     * of the signature.
+     *
+     * @param keys the list to replace with the keys, in position order
      */
-    std::vector<std::string> GetWords() const;
+    void GetWordKeys(WordKeys& keys) const;
 
     /**
      * Get the filename.
@@ -85,10 +112,100 @@ public:
         return cvec_;
     }
 
+    /**
+     * Get the sign-bit sketch of the cvec.
+     *
+     * @returns the sketch.
+     */
+    const std::vector<uint64_t>& GetSketch() const
+    {
+        return sketch_;
+    }
+
+    /**
+     * Get the raw SHA256 digest of the image file.
+     *
+     * @returns the digest, or an empty string if it is unknown.
+     */
+    const std::string& GetDigest() const
+    {
+        return digest_;
+    }
+
+    /**
+     * Set the raw SHA256 digest of the image file.
+     */
+    void SetDigest(const std::string& digest)
+    {
+        digest_ = digest;
+    }
+
+    /**
+     * Get the compressed signature, if it has been computed ahead of commit.
+     *
+     * @returns the compressed signature, or an empty string.
+     */
+    const std::string& GetCompressedSignature() const
+    {
+        return compressed_signature_;
+    }
+
+    /**
+     * Set the compressed signature so that committing the image does not
+     * have to compute it.
+     */
+    void SetCompressedSignature(std::string signature)
+    {
+        compressed_signature_ = std::move(signature);
+    }
+
+    /**
+     * Get the id of the image in the database.
+     *
+     * @returns the image id, or -1 if the image has not been committed.
+     */
+    int64_t GetID() const
+    {
+        return id_;
+    }
+
+    /**
+     * Set the id of the image in the database.
+     */
+    void SetID(int64_t id)
+    {
+        id_ = id;
+    }
+
+    /**
+     * Check whether the image has already been committed.
+     */
+    bool IsCommitted() const
+    {
+        return id_ != -1;
+    }
+
+private:
+    /**
+     * Compute the sketch of the cvec.
+     */
+    void ComputeSketch();
+
+    /**
+     * Split the cvec into the planes compressed signatures are compared
+     * with.
+     */
+    void SplitCvec();
+
 private:
     std::shared_ptr<Context> context_;
     std::string file_name_;
     Puzzle::CVec* cvec_;
+    std::vector<uint64_t> sketch_;
+    std::vector<signed char> split_;
+    std::string digest_;
+    std::string compressed_signature_;
+    int64_t id_;
 };
 
 }
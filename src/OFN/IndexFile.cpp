@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "SQLite3/SQLite3.h"
+
+#include "OFN/IndexFile.h"
+
+using namespace OFN;
+
+static const char Magic[8] = { 'O', 'F', 'N', 'I', 'N', 'D', 'E', 'X' };
+
+static void WriteVarint(std::string& buffer, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        buffer.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+
+    buffer.push_back(static_cast<char>(value));
+}
+
+IndexFile::IndexFile() :
+    data_(nullptr),
+    size_(0),
+    entries_(nullptr),
+    postings_(nullptr)
+{
+}
+
+IndexFile::~IndexFile()
+{
+    Close();
+}
+
+bool IndexFile::Open(const std::string& path)
+{
+    struct stat st;
+    int fd;
+
+    Close();
+
+    if ((fd = open(path.c_str(), O_RDONLY)) == -1)
+        return false;
+
+    if (fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(Header))
+    {
+        close(fd);
+        return false;
+    }
+
+    auto size = static_cast<size_t>(st.st_size);
+    auto data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+    // The mapping keeps its own reference to the file.
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return false;
+
+    auto header = static_cast<const Header*>(data);
+
+    // Every size is compared against what is left of the file, so a corrupt
+    // header cannot overflow the arithmetic.
+    if (memcmp(header->magic, Magic, sizeof Magic) != 0 ||
+        header->version != Version || header->header_size != sizeof(Header) ||
+        header->postings_offset > size ||
+        header->postings_size > size - header->postings_offset ||
+        header->postings_offset < header->header_size ||
+        header->num_keys >
+            (header->postings_offset - header->header_size) / sizeof(Entry) ||
+        !IsValidDirectory(
+            reinterpret_cast<const Entry*>(
+                static_cast<const char*>(data) + header->header_size),
+            header->num_keys, header->postings_size))
+    {
+        munmap(data, size);
+        return false;
+    }
+
+    // Posting lists are looked up by key, so read-ahead would mostly fetch
+    // pages that are never used.
+    madvise(data, size, MADV_RANDOM);
+
+    data_ = static_cast<const char*>(data);
+    size_ = size;
+    entries_ = reinterpret_cast<const Entry*>(data_ + header->header_size);
+    postings_ =
+        reinterpret_cast<const unsigned char*>(data_ + header->postings_offset);
+
+    return true;
+}
+
+bool IndexFile::IsValidDirectory(const Entry* entries, uint64_t num_keys,
+                                 uint64_t postings_size)
+{
+    for (uint64_t i = 0; i < num_keys; i++)
+    {
+        auto& entry = entries[i];
+
+        // Find relies on the keys being sorted and unique.
+        if (i > 0 && entries[i - 1].key >= entry.key)
+            return false;
+
+        if (entry.offset > postings_size ||
+            entry.size > postings_size - entry.offset)
+            return false;
+    }
+
+    return true;
+}
+
+void IndexFile::Close()
+{
+    if (data_ != nullptr)
+        munmap(const_cast<char*>(data_), size_);
+
+    data_ = nullptr;
+    size_ = 0;
+    entries_ = nullptr;
+    postings_ = nullptr;
+}
+
+const IndexFile::Entry* IndexFile::Find(Key key) const
+{
+    auto end = entries_ + GetHeader().num_keys;
+    auto it = std::lower_bound(
+        entries_, end, key,
+        [](const Entry& entry, Key value) { return entry.key < value; });
+
+    if (it == end || it->key != key)
+        return nullptr;
+
+    return it;
+}
+
+void IndexFile::Decode(const Entry& entry, std::vector<uint32_t>& ids) const
+{
+    auto ptr = postings_ + entry.offset;
+    auto end = ptr + entry.size;
+    uint32_t id = 0;
+
+    while (ptr < end)
+    {
+        uint32_t value = 0;
+        int shift = 0;
+
+        // A 32-bit value takes at most five bytes, so a longer run of
+        // continuation bytes is cut short rather than shifted out of range.
+        while (ptr < end && (*ptr & 0x80) && shift < 28)
+        {
+            value |= static_cast<uint32_t>(*ptr++ & 0x7f) << shift;
+            shift += 7;
+        }
+
+        if (ptr < end)
+            value |= static_cast<uint32_t>(*ptr++) << shift;
+
+        id += value;
+        ids.push_back(id);
+    }
+}
+
+void IndexFile::Vote(const WordKeys& keys,
+                     std::unordered_map<uint32_t, int>& votes) const
+{
+    std::vector<uint32_t> ids;
+
+    for (auto key : keys)
+    {
+        if (auto entry = Find(key))
+        {
+            ids.clear();
+            Decode(*entry, ids);
+
+            for (auto id : ids)
+                votes[id]++;
+        }
+    }
+}
+
+bool IndexFile::Build(const std::string& path, SQLite3::Connection& conn)
+{
+    using Posting = std::pair<Key, uint32_t>;
+
+    auto statement = conn.Prepare(
+        "SELECT words.word_key, words.signature_id FROM words "
+        "INNER JOIN signatures ON signatures.id = words.signature_id");
+
+    if (!statement)
+        return false;
+
+    std::vector<Posting> postings;
+    uint32_t max_signature_id = 0;
+
+    while (auto row = statement->Step())
+    {
+        auto id = static_cast<uint32_t>(row.GetInt64(1));
+
+        postings.emplace_back(row.GetInt64(0), id);
+        max_signature_id = std::max(max_signature_id, id);
+    }
+
+    if (!statement->IsDone())
+        return false;
+
+    std::sort(postings.begin(), postings.end());
+    postings.erase(std::unique(postings.begin(), postings.end()),
+                   postings.end());
+
+    std::vector<Entry> entries;
+    std::string data;
+
+    for (size_t i = 0; i < postings.size();)
+    {
+        Entry entry{ postings[i].first, data.size(), 0, 0 };
+        uint32_t previous = 0;
+
+        for (; i < postings.size() && postings[i].first == entry.key; i++)
+        {
+            WriteVarint(data, postings[i].second - previous);
+            previous = postings[i].second;
+            entry.count++;
+        }
+
+        entry.size = static_cast<uint32_t>(data.size() - entry.offset);
+        entries.push_back(entry);
+    }
+
+    Header header;
+
+    memcpy(header.magic, Magic, sizeof Magic);
+    header.version = Version;
+    header.header_size = sizeof(Header);
+    header.num_keys = entries.size();
+    header.num_postings = postings.size();
+    header.max_signature_id = max_signature_id;
+    header.postings_offset = sizeof(Header) + entries.size() * sizeof(Entry);
+    header.postings_size = data.size();
+
+    auto temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof header);
+    file.write(reinterpret_cast<const char*>(entries.data()),
+               entries.size() * sizeof(Entry));
+    file.write(data.data(), data.size());
+    file.close();
+
+    if (!file.good())
+    {
+        std::remove(temporary.c_str());
+        return false;
+    }
+
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
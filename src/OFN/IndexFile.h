@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#pragma once
+
+/**
+ * @file IndexFile.h
+ * @brief Memory-mapped on-disk inverted word index.
+ * @author Mikkel Kroman
+ *
+ * The file starts with an IndexFile::Header, followed by a directory of
+ * IndexFile::Entry records sorted by key and finally the posting lists. Each
+ * posting list is a sequence of LEB128 varints where the first value is a
+ * signature id and every following value is the difference to the previous
+ * one. The header and directory are stored in the byte order of the host
+ * that built the file, so an index file is not portable between hosts of
+ * different endianness; it can always be rebuilt from the database.
+ */
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "OFN/WordIndex.h"
+
+namespace OFN
+{
+
+namespace SQLite3
+{
+class Connection;
+}
+
+/**
+ * %IndexFile class.
+ *
+ * A read-only view of an index file. Opening the file only maps it into
+ * memory, so looking up a key costs a binary search over the directory and
+ * the page faults for the posting lists that are actually touched.
+ */
+class IndexFile
+{
+public:
+    using Key = WordIndex::Key;
+
+    /** The current file format version. */
+    static const uint32_t Version = 2;
+
+    /**
+     * The file header.
+     */
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t header_size;
+        uint64_t num_keys;
+        uint64_t num_postings;
+        uint64_t max_signature_id;
+        uint64_t postings_offset;
+        uint64_t postings_size;
+    };
+
+    /**
+     * A directory entry describing the posting list of a single key.
+     */
+    struct Entry
+    {
+        Key key;
+        uint64_t offset;
+        uint32_t count;
+        uint32_t size;
+    };
+
+    /**
+     * Construct a closed index file.
+     */
+    IndexFile();
+
+    /**
+     * Destruct the index file, unmapping it if it is open.
+     */
+    ~IndexFile();
+
+    IndexFile(const IndexFile&) = delete;
+    IndexFile& operator=(const IndexFile&) = delete;
+
+    /**
+     * Map an index file into memory.
+     *
+     * @param path the path to the index file
+     *
+     * The directory is checked when the file is opened, so that every entry
+     * found later lies within the posting lists.
+     *
+     * @returns true on success, false if the file is missing, has an
+     * unsupported version or is malformed.
+     */
+    bool Open(const std::string& path);
+
+    /**
+     * Unmap the index file.
+     */
+    void Close();
+
+    /**
+     * Check whether the index file is open.
+     */
+    bool IsOpen() const
+    {
+        return data_ != nullptr;
+    }
+
+    /**
+     * Find the directory entry of a key.
+     *
+     * @returns a pointer to the entry, or nullptr if the key is unknown.
+     */
+    const Entry* Find(Key key) const;
+
+    /**
+     * Decode the posting list of a directory entry.
+     *
+     * @param entry the directory entry
+     * @param ids   the vector to append the signature ids to
+     */
+    void Decode(const Entry& entry, std::vector<uint32_t>& ids) const;
+
+    /**
+     * Count how many of the given keys each signature is listed under.
+     *
+     * @param keys  the packed word keys of the query
+     * @param votes the vote counts to add to, keyed by signature id
+     */
+    void Vote(const WordKeys& keys,
+              std::unordered_map<uint32_t, int>& votes) const;
+
+    /**
+     * Get the file header.
+     */
+    const Header& GetHeader() const
+    {
+        return *reinterpret_cast<const Header*>(data_);
+    }
+
+    /**
+     * Get the highest signature id covered by the index file.
+     */
+    int64_t GetMaxSignatureID() const
+    {
+        return GetHeader().max_signature_id;
+    }
+
+    /**
+     * Build an index file from the `words` and `signatures` tables.
+     *
+     * The file is written to a temporary path and renamed into place, so
+     * readers never see a partially written index.
+     *
+     * @param path the path to write the index file to
+     * @param conn the database connection to read from
+     *
+     * @returns true on success, false otherwise.
+     */
+    static bool Build(const std::string& path, SQLite3::Connection& conn);
+
+private:
+    /**
+     * Check that the keys of a directory are sorted and unique, and that every
+     * posting list lies within the posting lists of the file.
+     */
+    static bool IsValidDirectory(const Entry* entries, uint64_t num_keys,
+                                 uint64_t postings_size);
+
+    const char* data_;
+    size_t size_;
+    const Entry* entries_;
+    const unsigned char* postings_;
+};
+
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include <thread>
+#include <algorithm>
+#include <exception>
+
+#include "OFN/OFN.h"
+#include "OFN/Image.h"
+#include "OFN/Context.h"
+#include "OFN/Puzzle.h"
+#include "OFN/IngestPipeline.h"
+
+using namespace OFN;
+
+/** The number of window slots per decode worker. */
+static const size_t SlotsPerWorker = 4;
+
+IngestPipeline::IngestPipeline(Context& context, size_t num_workers,
+                               size_t chunk_size) :
+    context_(context),
+    num_workers_(num_workers),
+    chunk_size_(chunk_size),
+    next_(0),
+    written_(0),
+    stop_(false)
+{
+    if (num_workers_ == 0)
+        num_workers_ = std::max(1u, std::thread::hardware_concurrency());
+
+    window_.resize(num_workers_ * SlotsPerWorker);
+}
+
+IngestPipeline::~IngestPipeline()
+{
+}
+
+std::vector<int64_t>
+IngestPipeline::Run(const std::vector<std::string>& filenames)
+{
+    std::vector<int64_t> result(filenames.size(), -1);
+    std::vector<std::unique_ptr<Image>> chunk;
+    std::vector<size_t> indices;
+    std::vector<std::thread> workers;
+    auto chunk_size = chunk_size_ ? chunk_size_ : filenames.size();
+
+    next_ = 0;
+    written_ = 0;
+    stop_ = false;
+    committed_.clear();
+
+    for (size_t i = 0; i < num_workers_; i++)
+        workers.emplace_back(&IngestPipeline::DecodeLoop, this,
+                             std::cref(filenames));
+
+    try
+    {
+        while (written_ < filenames.size())
+        {
+            std::unique_ptr<Image> image;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                auto& slot = window_[written_ % window_.size()];
+
+                ready_.wait(lock, [&slot] { return slot.ready; });
+
+                image = std::move(slot.image);
+                slot.ready = false;
+                written_++;
+            }
+
+            claimable_.notify_all();
+
+            if (image)
+            {
+                chunk.push_back(std::move(image));
+                indices.push_back(written_ - 1);
+            }
+
+            if (chunk.size() >= chunk_size)
+                CommitChunk(chunk, indices, result);
+        }
+
+        CommitChunk(chunk, indices, result);
+    }
+    catch (...)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+
+        claimable_.notify_all();
+
+        for (auto& worker : workers)
+            worker.join();
+
+        throw;
+    }
+
+    for (auto& worker : workers)
+        worker.join();
+
+    return result;
+}
+
+void IngestPipeline::DecodeLoop(const std::vector<std::string>& filenames)
+{
+    auto puzzle = std::make_shared<Puzzle::Context>();
+
+    for (;;)
+    {
+        size_t index;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            // Only claim a file once its slot in the window has been freed by
+            // the writer.
+            claimable_.wait(lock, [this, &filenames] {
+                return stop_ || next_ >= filenames.size() ||
+                       next_ < written_ + window_.size();
+            });
+
+            if (stop_ || next_ >= filenames.size())
+                break;
+
+            index = next_++;
+        }
+
+        // Decode never throws, so the slot is always marked ready and the
+        // writer cannot wait on it forever.
+        auto image = Decode(filenames[index], puzzle);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& slot = window_[index % window_.size()];
+
+            slot.image = std::move(image);
+            slot.ready = true;
+        }
+
+        ready_.notify_one();
+    }
+
+    // Close the reader OpenImage opened for this thread.
+    context_.ReleaseReader();
+}
+
+std::unique_ptr<Image>
+IngestPipeline::Decode(const std::string& filename,
+                       std::shared_ptr<Puzzle::Context> puzzle)
+{
+    auto console = spdlog::get("console");
+
+    try
+    {
+        console->info("Comitting image '{}'", filename);
+
+        auto image = context_.OpenImage(filename, puzzle);
+
+        if (!image->IsCommitted())
+        {
+            auto compressed = image->GetCvec()->Compress();
+
+            image->SetCompressedSignature(
+                std::string(reinterpret_cast<char*>(compressed->GetVec()),
+                            compressed->GetSize()));
+        }
+
+        return image;
+    }
+    catch (const Puzzle::RuntimeError& error)
+    {
+        console->error("Puzzle error: {}", error.what());
+    }
+    catch (const RuntimeError& error)
+    {
+        console->error("Failed to open '{}': {}", filename, error.what());
+    }
+    catch (const std::exception& error)
+    {
+        console->error("Failed to decode '{}': {}", filename, error.what());
+    }
+    catch (...)
+    {
+        console->error("Failed to decode '{}'", filename);
+    }
+
+    return nullptr;
+}
+
+void IngestPipeline::CommitChunk(std::vector<std::unique_ptr<Image>>& chunk,
+                                 std::vector<size_t>& indices,
+                                 std::vector<int64_t>& result)
+{
+    auto console = spdlog::get("console");
+
+    if (chunk.empty())
+        return;
+
+    std::vector<const Image*> images;
+    std::vector<size_t> positions;
+
+    images.reserve(chunk.size());
+    positions.reserve(chunk.size());
+
+    for (size_t i = 0; i < chunk.size(); i++)
+    {
+        auto& image = *chunk[i];
+
+        // The image was decoded before an earlier chunk holding the same file
+        // was committed, so the digest lookup in OpenImage missed it.
+        auto duplicate = committed_.find(image.GetDigest());
+
+        if (!image.IsCommitted() && duplicate != committed_.end())
+        {
+            console->info(
+                "Image '{}' has already been committed as image {:d}",
+                image.GetFileName(), duplicate->second);
+
+            result[indices[i]] = duplicate->second;
+            continue;
+        }
+
+        images.push_back(&image);
+        positions.push_back(indices[i]);
+    }
+
+    auto ids = context_.CommitBatch(images);
+
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        result[positions[i]] = ids[i];
+
+        if (ids[i] != -1 && !images[i]->GetDigest().empty())
+            committed_.emplace(images[i]->GetDigest(), ids[i]);
+    }
+
+    chunk.clear();
+    indices.clear();
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#pragma once
+
+/**
+ * @file IngestPipeline.h
+ * @brief Parallel decoding of images for commit.
+ * @author Mikkel Kroman
+ */
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <condition_variable>
+
+namespace OFN
+{
+
+namespace Puzzle
+{
+class Context;
+}
+
+class Context;
+class Image;
+
+/**
+ * %IngestPipeline class.
+ *
+ * Commits a list of files with a set of decode workers and a single writer.
+ * Every worker owns its own puzzle context and hashes, decodes and
+ * compresses images, while the calling thread owns the database connection
+ * and commits the results in chunks, each in one transaction.
+ *
+ * Decoded images are handed to the writer through a window of a fixed number
+ * of slots. A worker only claims a file once its slot is free, so workers
+ * block when the writer falls behind, and images are committed in the order
+ * they were given.
+ */
+class IngestPipeline
+{
+public:
+    /**
+     * Construct a pipeline.
+     *
+     * @param context     the context to commit to
+     * @param num_workers the number of decode workers, or 0 for every core
+     * @param chunk_size  the number of images per transaction, or 0 to
+     *                    commit every image in one transaction
+     */
+    IngestPipeline(Context& context, size_t num_workers, size_t chunk_size);
+
+    /**
+     * Destruct the pipeline.
+     */
+    ~IngestPipeline();
+
+    IngestPipeline(const IngestPipeline&) = delete;
+    IngestPipeline& operator=(const IngestPipeline&) = delete;
+
+    /**
+     * Decode and commit a list of files.
+     *
+     * Files that fail to decode are logged and skipped.
+     *
+     * @param filenames the files to commit
+     *
+     * @returns the id of each image, or -1 where it failed, in the order of
+     * `filenames`.
+     *
+     * @throws the first error raised while committing.
+     */
+    std::vector<int64_t> Run(const std::vector<std::string>& filenames);
+
+    /**
+     * Get the number of decode workers.
+     */
+    size_t GetNumWorkers() const
+    {
+        return num_workers_;
+    }
+
+private:
+    /**
+     * A decoded image waiting to be committed.
+     */
+    struct Slot
+    {
+        bool ready = false;
+        std::unique_ptr<Image> image;
+    };
+
+    /**
+     * The loop run by every decode worker.
+     */
+    void DecodeLoop(const std::vector<std::string>& filenames);
+
+    /**
+     * Open an image and compress its signature and words.
+     *
+     * Never throws; every error is logged instead.
+     *
+     * @returns the image, or nullptr if it could not be decoded.
+     */
+    std::unique_ptr<Image> Decode(const std::string& filename,
+                                  std::shared_ptr<Puzzle::Context> puzzle);
+
+    /**
+     * Commit a chunk of images and record their ids.
+     *
+     * Images whose digest was committed by an earlier chunk of the same run
+     * are not inserted again but get the id of the earlier image.
+     */
+    void CommitChunk(std::vector<std::unique_ptr<Image>>& chunk,
+                     std::vector<size_t>& indices,
+                     std::vector<int64_t>& result);
+
+    Context& context_;
+    size_t num_workers_;
+    size_t chunk_size_;
+
+    std::mutex mutex_;
+    std::condition_variable claimable_;
+    std::condition_variable ready_;
+    std::vector<Slot> window_;
+    std::unordered_map<std::string, int64_t> committed_;
+    size_t next_;
+    size_t written_;
+    bool stop_;
+};
+
+}
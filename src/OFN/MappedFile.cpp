@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "OFN/MappedFile.h"
+
+using namespace OFN;
+
+MappedFile::MappedFile() :
+    data_(nullptr),
+    size_(0),
+    mapped_(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string& path)
+{
+    struct stat st;
+    int fd;
+
+    Close();
+
+    if ((fd = open(path.c_str(), O_RDONLY)) == -1)
+        return false;
+
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        auto size = static_cast<size_t>(st.st_size);
+        auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED)
+        {
+            // The file is hashed and decoded front to back.
+            madvise(data, size, MADV_SEQUENTIAL);
+            close(fd);
+
+            data_ = data;
+            size_ = size;
+            mapped_ = true;
+
+            return true;
+        }
+    }
+
+    auto result = ReadAll(fd);
+
+    close(fd);
+
+    return result;
+}
+
+void MappedFile::Close()
+{
+    if (mapped_)
+        munmap(const_cast<void*>(data_), size_);
+
+    data_ = nullptr;
+    size_ = 0;
+    mapped_ = false;
+    buffer_.clear();
+}
+
+bool MappedFile::ReadAll(int fd)
+{
+    const size_t chunk_size = 65536;
+    size_t size = 0;
+
+    for (;;)
+    {
+        buffer_.resize(size + chunk_size);
+
+        auto result = read(fd, buffer_.data() + size, chunk_size);
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            buffer_.clear();
+            return false;
+        }
+
+        if (result == 0)
+            break;
+
+        size += result;
+    }
+
+    buffer_.resize(size);
+    data_ = buffer_.data();
+    size_ = size;
+
+    return true;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#pragma once
+
+/**
+ * @file MappedFile.h
+ * @brief Read-only view of a whole file in memory.
+ * @author Mikkel Kroman
+ */
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace OFN
+{
+
+/**
+ * %MappedFile class.
+ *
+ * Maps a file into memory so that it can be hashed and decoded from the same
+ * bytes. Files that cannot be mapped, such as pipes, are read into a buffer
+ * instead.
+ */
+class MappedFile
+{
+public:
+    /**
+     * Construct a closed file.
+     */
+    MappedFile();
+
+    /**
+     * Destruct the file, unmapping it.
+     */
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * Map a file into memory.
+     *
+     * @param path the path to the file
+     *
+     * @returns true on success, false otherwise.
+     */
+    bool Open(const std::string& path);
+
+    /**
+     * Unmap the file.
+     */
+    void Close();
+
+    /**
+     * Get the contents of the file.
+     *
+     * The pointer is valid until the file is closed.
+     */
+    const void* GetData() const
+    {
+        return data_;
+    }
+
+    /**
+     * Get the size of the file in bytes.
+     */
+    size_t GetSize() const
+    {
+        return size_;
+    }
+
+private:
+    /**
+     * Read the rest of a file descriptor into the buffer.
+     */
+    bool ReadAll(int fd);
+
+    const void* data_;
+    size_t size_;
+    bool mapped_;
+    std::vector<char> buffer_;
+};
+
+}
@@ -34,7 +34,44 @@ namespace OFN
 static const char* Version = "0.1.1";
 static const double SimilarityThreshold = 0.6;
 
-static auto Console = spdlog::stdout_logger_mt("console");
+/** The maximum number of vote-ranked candidates to score per search. */
+static const int MaxCandidates = 1000;
+
+/** The maximum number of matches to report per search. */
+static const int MaxMatches = 100;
+
+/** The largest number of matches that can be asked for per search. */
+static const size_t MatchesLimit = 10000;
+
+/** The number of images searched for together in one batch. */
+static const size_t BatchSize = 1000;
+
+/** The number of images committed together in one transaction. */
+static const size_t CommitChunkSize = 1000;
+
+/** The largest number of images that can be committed per transaction. */
+static const size_t CommitChunkSizeLimit = 1000000;
+
+/** The number of random vector pairs each distance kernel is checked with. */
+static const size_t KernelCheckTrials = 20000;
+
+/** The largest number of worker threads allowed per hardware thread. */
+static const unsigned MaxThreadsPerCore = 4;
+
+/** The number of words a candidate has to share with the query. */
+static const int MinVotes = 1;
+
+/**
+ * The fraction of signatures a word may be found in before search ignores it,
+ * where 1 disables the stoplist.
+ */
+static const double MaxWordFrequency = 1.0;
+
+/** The memory budget of the signature cache, in megabytes. */
+static const size_t SignatureCacheSize = 64;
+
+// Log to stderr so search results on stdout stay machine-readable.
+static auto Console = spdlog::stderr_logger_mt("console");
 
 
 /**
@@ -76,10 +113,15 @@ public:
     ~Application();
 
     /**
-     * Search for similar images in the database.
+     * Search for similar images in the database and print the matches.
      */
     void Search(std::vector<std::string> parameters);
 
+    /**
+     * Print the matches of a search, one machine-readable line per match.
+     */
+    void PrintMatches(const std::string& filename, const MatchVector& matches);
+
     /**
      * Commit a new image to the database.
      */
@@ -91,6 +133,27 @@ public:
      */
     void Process(std::vector<std::string> parameters);
 
+    /**
+     * Rebuild the word index file from the database.
+     */
+    void Reindex(std::vector<std::string> parameters);
+
+    /**
+     * Convert the words table of an old database to the current layout.
+     */
+    void Migrate(std::vector<std::string> parameters);
+
+    /**
+     * Report how much the stoplist and minimum votes narrow down the
+     * candidates of each image.
+     */
+    void Candidates(std::vector<std::string> parameters);
+
+    /**
+     * Compare every distance kernel the CPU supports against libpuzzle.
+     */
+    void Check(std::vector<std::string> parameters);
+
     /**
      * Print the command-line usage.
      */
@@ -106,8 +169,34 @@ public:
      */
     std::vector<std::string> ParseParameters(int argc, char* argv[]);
 
+    /**
+     * Open the database with the settings given on the command-line.
+     *
+     * Unless a profile has been chosen, the `default` profile is used, which
+     * leaves the journal mode and durability of the database untouched.
+     *
+     * @param command the command that is going to be run
+     *
+     * @throws CommandLineError if the profile or a setting is invalid.
+     */
+    void OpenContext(const std::string& command);
+
 protected:
     std::shared_ptr<Context> context_;
+    size_t max_matches_;
+    double threshold_;
+    size_t commit_chunk_size_;
+    size_t num_threads_;
+    size_t num_words_;
+    size_t cache_size_;
+    int min_votes_;
+    double max_word_frequency_;
+    bool set_num_threads_;
+    bool load_word_index_;
+    bool load_signature_store_;
+    std::string database_path_;
+    std::string profile_;
+    std::vector<std::string> pragmas_;
 };
 
 }
@@ -33,6 +33,8 @@ extern "C" {
 #include "OFN/Puzzle/Context.h"
 #include "OFN/Puzzle/CVec.h"
 #include "OFN/Puzzle/CompressedCVec.h"
+#include "OFN/Puzzle/Distance.h"
+#include "OFN/Puzzle/Sketch.h"
 
 namespace OFN
 { 
@@ -21,6 +21,7 @@
 #include "OFN/Puzzle/CVec.h"
 #include "OFN/Puzzle/Errors.h"
 #include "OFN/Puzzle/Context.h"
+#include "OFN/Puzzle/Distance.h"
 #include "OFN/Puzzle/CompressedCVec.h"
 
 using namespace OFN::Puzzle;
@@ -41,6 +42,15 @@ CVec::CVec(std::shared_ptr<Context> context, const std::string& file) :
         throw BitmapLoadError("Could not load bitmap file");
 }
 
+CVec::CVec(std::shared_ptr<Context> context, const void* data, size_t size) :
+    context_(context)
+{
+    puzzle_init_cvec(context_->GetPuzzleContext(), &cvec_);
+
+    if (!LoadMemory(data, size))
+        throw BitmapLoadError("Could not load bitmap data");
+}
+
 CVec::~CVec()
 {
     puzzle_free_cvec(context_->GetPuzzleContext(), &cvec_);
@@ -52,6 +62,12 @@ bool CVec::LoadFile(const std::string& file)
                                        file.c_str()) == 0);
 }
 
+bool CVec::LoadMemory(const void* data, size_t size)
+{
+    return (puzzle_fill_cvec_from_mem(context_->GetPuzzleContext(), &cvec_,
+                                      data, size) == 0);
+}
+
 std::unique_ptr<CompressedCVec> CVec::Compress() const
 {
     auto cvec = std::make_unique<CompressedCVec>(context_);
@@ -79,8 +95,35 @@ void CVec::SetVec(const std::string& string)
 
 double CVec::GetDistance(const CVec& other) const
 {
-    return puzzle_vector_normalized_distance(context_->GetPuzzleContext(),
-                                             &cvec_, &other.cvec_, 0);
+    return GetDistance(other.cvec_.vec, other.cvec_.sizeof_vec);
+}
+
+double CVec::GetDistance(const signed char* vec, size_t size) const
+{
+    // libpuzzle treats vectors of different sizes as a bug, so let it report
+    // those itself.
+    if (cvec_.sizeof_vec != size)
+    {
+        PuzzleCvec other;
+
+        other.vec = const_cast<signed char*>(vec);
+        other.sizeof_vec = size;
+
+        return puzzle_vector_normalized_distance(context_->GetPuzzleContext(),
+                                                 &cvec_, &other, 0);
+    }
+
+    return NormalizedDistance(cvec_.vec, vec, size);
+}
+
+double CVec::GetDistance(const signed char* vec, size_t size, double cutoff,
+                         uint64_t length, uint64_t other_length) const
+{
+    if (cvec_.sizeof_vec != size)
+        return GetDistance(vec, size);
+
+    return NormalizedDistanceBounded(cvec_.vec, vec, size, cutoff, length,
+                                     other_length);
 }
 
 std::unique_ptr<CVec>
@@ -26,11 +26,14 @@
 
 #include <string>
 #include <memory>
+#include <cstdint>
 
 extern "C" {
 #include <puzzle.h>
 }
 
+#include "OFN/Puzzle/Distance.h"
+
 namespace OFN
 {
 namespace Puzzle
@@ -65,6 +68,15 @@ public:
      */
     CVec(std::shared_ptr<Context> context, const std::string& file);
 
+    /**
+     * Construct a cvec and fill it with bitmap data from an image in memory.
+     *
+     * @param context a pointer to a puzzle context
+     * @param data    the encoded image
+     * @param size    the size of the encoded image in bytes
+     */
+    CVec(std::shared_ptr<Context> context, const void* data, size_t size);
+
     /**
      * Destruct the cvec.
      */
@@ -79,6 +91,16 @@ public:
      */
     bool LoadFile(const std::string& file);
 
+    /**
+     * Fill a cvec with bitmap data from an image in memory.
+     *
+     * @param data the encoded image
+     * @param size the size of the encoded image in bytes
+     *
+     * @returns true on success, false otherwise.
+     */
+    bool LoadMemory(const void* data, size_t size);
+
     /**
      * Compress the vec and return a new compressed cvec.
      *
@@ -135,6 +157,33 @@ public:
      */
     double GetDistance(const CVec& other) const;
 
+    /**
+     * Compare this vector with a vector in a raw buffer and return the
+     * normalized distance.
+     *
+     * @param vec  the values of the other vector
+     * @param size the number of values
+     */
+    double GetDistance(const signed char* vec, size_t size) const;
+
+    /**
+     * Compare this vector with a vector in a raw buffer, giving up once the
+     * distance provably reaches a cutoff.
+     *
+     * @param vec          the values of the other vector
+     * @param size         the number of values
+     * @param cutoff       the distance the vectors have to stay under
+     * @param length       the squared length of this vector, or UnknownLength
+     * @param other_length the squared length of the other vector, or
+     *                     UnknownLength
+     *
+     * @returns the normalized distance, or a lower bound of at least the
+     * cutoff if the comparison was abandoned.
+     */
+    double GetDistance(const signed char* vec, size_t size, double cutoff,
+                       uint64_t length = UnknownLength,
+                       uint64_t other_length = UnknownLength) const;
+
     /**
      * Get the raw puzzle C context.
      *
@@ -16,6 +16,8 @@
  */
 
 #include <memory>
+#include <cstdint>
+#include <cstring>
 
 #include "OFN/Puzzle/CVec.h"
 #include "OFN/Puzzle/Context.h"
@@ -23,6 +25,34 @@
 
 using namespace OFN::Puzzle;
 
+namespace
+{
+
+/**
+ * Build the table of the three values of every byte, packed into the low
+ * bytes of a 32-bit word in memory order so it can be stored in one write.
+ */
+std::vector<uint32_t> MakeDecodeTable()
+{
+    std::vector<uint32_t> table(128);
+
+    for (unsigned int x = 0; x < table.size(); x++)
+    {
+        signed char values[4] = { static_cast<signed char>(x % 5 - 2),
+                                  static_cast<signed char>(x / 5 % 5 - 2),
+                                  static_cast<signed char>(x / 25 % 5 - 2),
+                                  0 };
+
+        memcpy(&table[x], values, sizeof(values));
+    }
+
+    return table;
+}
+
+const std::vector<uint32_t> DecodeTable = MakeDecodeTable();
+
+}
+
 CompressedCVec::CompressedCVec(std::shared_ptr<Context> context) :
     context_(context)
 {
@@ -60,3 +90,49 @@ PuzzleContext* CompressedCVec::GetPuzzleContext()
     return context_->GetPuzzleContext();
 }
 
+size_t OFN::Puzzle::GetUncompressedSize(const void* data, size_t size)
+{
+    auto ptr = static_cast<const unsigned char*>(data);
+
+    if (size < 2)
+        return 0;
+
+    size_t trailing = ((ptr[0] & 0x80) >> 7) | ((ptr[1] & 0x80) >> 6);
+
+    if (trailing > 2)
+        return 0;
+
+    size_t full = trailing ? size - 1 : size;
+
+    return full * CompressedValuesPerByte + trailing;
+}
+
+void OFN::Puzzle::UncompressBytes(const unsigned char* data, size_t count,
+                                  signed char* vec)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(vec, &DecodeTable[data[i] & 0x7f], sizeof(uint32_t));
+        vec += CompressedValuesPerByte;
+    }
+}
+
+bool OFN::Puzzle::Uncompress(const void* data, size_t size,
+                             std::vector<signed char>& vec)
+{
+    auto count = GetUncompressedSize(data, size);
+
+    if (count == 0)
+        return false;
+
+    // Room for the extra value written by the last byte.
+    vec.resize(count + CompressedValuesPerByte);
+    UncompressBytes(static_cast<const unsigned char*>(data),
+                    (count + CompressedValuesPerByte - 1) /
+                        CompressedValuesPerByte,
+                    vec.data());
+    vec.resize(count);
+
+    return true;
+}
+
@@ -25,6 +25,7 @@
  */
 
 #include <memory>
+#include <vector>
 
 extern "C" {
 #include "puzzle.h"
@@ -123,5 +124,49 @@ private:
     std::shared_ptr<Context> context_;
 };
 
+/** The number of values held by each byte of a compressed vector. */
+static const size_t CompressedValuesPerByte = 3;
+
+/**
+ * Get the number of values in a compressed vector buffer.
+ *
+ * @param data the compressed vector
+ * @param size the size of the compressed vector in bytes
+ *
+ * @returns the number of values, or 0 if the buffer is malformed.
+ */
+size_t GetUncompressedSize(const void* data, size_t size);
+
+/**
+ * Uncompress a run of bytes of a compressed vector buffer.
+ *
+ * Every byte is decoded into three values, including the upper digits of a
+ * trailing partial byte, which the caller should ignore.
+ *
+ * @param data  the bytes to uncompress
+ * @param count the number of bytes
+ * @param vec   the array to write the values to, with room for
+ *              `3 * count + 1` values since each byte is written as four
+ */
+void UncompressBytes(const unsigned char* data, size_t count,
+                     signed char* vec);
+
+/**
+ * Uncompress a compressed vector buffer into a reusable vector.
+ *
+ * This decodes the format written by `puzzle_compress_cvec` directly: each
+ * byte holds three values as base-5 digits, lowest first, and the top bits of
+ * the first two bytes count the values in a trailing partial byte. Unlike
+ * CompressedCVec::Uncompress, no memory is allocated once the vector is large
+ * enough.
+ *
+ * @param data the compressed vector
+ * @param size the size of the compressed vector in bytes
+ * @param vec  the vector to replace with the uncompressed values
+ *
+ * @returns true on success, false if the buffer is malformed.
+ */
+bool Uncompress(const void* data, size_t size, std::vector<signed char>& vec);
+
 }
 }
@@ -0,0 +1,968 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define OFN_DISTANCE_X86 1
+# include <immintrin.h>
+#endif
+
+#include "OFN/Puzzle/Distance.h"
+#include "OFN/Puzzle/CompressedCVec.h"
+
+using namespace OFN::Puzzle;
+
+namespace
+{
+
+/**
+ * The number of elements summed between checks of the bound, a multiple of
+ * the widest kernel's step.
+ */
+const size_t BoundBlockSize = 64;
+
+/**
+ * The number of compressed bytes decoded between checks of the bound, a
+ * multiple of the widest kernel's step.
+ */
+const size_t CompressedBlockSize = 32;
+
+/*
+ * A compressed byte x holds the base-5 digits x % 5, x / 5 % 5 and x / 25 % 5.
+ * For x below 128, x / 5 and x / 25 are the high halves of x * 13108 and
+ * x * 2622, which lets 16-bit lanes divide with one multiply each.
+ */
+const uint16_t DivideBy5 = 13108;
+const uint16_t DivideBy25 = 2622;
+
+/** The seed of the vectors that CheckDistanceKernel compares. */
+const unsigned KernelCheckSeed = 5489;
+
+/** The largest vector that CheckDistanceKernel compares. */
+const size_t MaxCheckSize = 1100;
+
+/** The largest square of a cvec element. */
+const double MaxSquare = 4.0;
+
+/**
+ * The sums of squares needed for a normalized distance.
+ */
+struct Sums
+{
+    uint32_t aa;
+    uint32_t bb;
+    uint32_t dd;
+};
+
+/**
+ * A distance cutoff and the lengths of the vectors, as far as they are known.
+ */
+struct Bound
+{
+    double squared_cutoff;
+
+    /** The length of the first vector, or a negative value if unknown. */
+    double a_length;
+
+    /** The length of the second vector, or a negative value if unknown. */
+    double b_length;
+
+    /** Whether the partial lengths are needed to check the bound. */
+    bool NeedsLengths() const
+    {
+        return a_length < 0.0 || b_length < 0.0;
+    }
+};
+
+using SumsFunc = void (*)(const signed char*, const signed char*, size_t,
+                          Sums&);
+
+/**
+ * Sums a split vector and the whole bytes of a compressed vector, checking
+ * the bound after every CompressedBlockSize bytes.
+ *
+ * @param split      the split vector
+ * @param plane_size the number of elements in each plane of the split vector
+ * @param data       the compressed bytes
+ * @param count      the number of whole bytes
+ * @param size       the number of elements in the vectors
+ *
+ * @returns a lower bound of at least the cutoff if the vectors were
+ * abandoned, or a negative value once every byte has been summed.
+ */
+using CompressedFunc = double (*)(const signed char* split, size_t plane_size,
+                                  const unsigned char* data, size_t count,
+                                  size_t size, const Bound& bound,
+                                  Sums& sums);
+
+/**
+ * Sums the vectors like a SumsFunc, but checks the bound after every
+ * BoundBlockSize elements.
+ *
+ * @returns a lower bound of at least the cutoff if the vectors were
+ * abandoned, or a negative value once every element has been summed.
+ */
+using BoundedFunc = double (*)(const signed char*, const signed char*, size_t,
+                               const Bound&, Sums&);
+
+/**
+ * Check whether partial sums prove that the distance reaches the cutoff.
+ *
+ * An unknown length is bounded by taking every remaining element to be as
+ * large as a cvec element can be.
+ *
+ * @param sums      the sums of the elements so far, where `aa` and `bb` are
+ *                  only needed for unknown lengths
+ * @param remaining the number of elements left
+ *
+ * @returns the lower bound on the distance if it reaches the cutoff, or a
+ * negative value otherwise.
+ */
+inline double CheckBound(const Bound& bound, const Sums& sums,
+                         size_t remaining)
+{
+    auto a_length = bound.a_length >= 0.0
+                        ? bound.a_length
+                        : std::sqrt(sums.aa + MaxSquare * remaining);
+    auto b_length = bound.b_length >= 0.0
+                        ? bound.b_length
+                        : std::sqrt(sums.bb + MaxSquare * remaining);
+    auto length = a_length + b_length;
+    auto dd = static_cast<double>(sums.dd);
+
+    // The distance is at least sqrt(dd) / length, compared squared to keep
+    // the check free of square roots when both lengths are known.
+    if (length > 0.0 && dd >= bound.squared_cutoff * length * length)
+        return std::sqrt(dd) / length;
+
+    return -1.0;
+}
+
+void SumsScalar(const signed char* a, const signed char* b, size_t size,
+                Sums& sums)
+{
+    uint32_t aa = 0, bb = 0, dd = 0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        int x = a[i], y = b[i], d = x - y;
+
+        aa += x * x;
+        bb += y * y;
+        dd += d * d;
+    }
+
+    sums.aa += aa;
+    sums.bb += bb;
+    sums.dd += dd;
+}
+
+double BoundedScalar(const signed char* a, const signed char* b, size_t size,
+                     const Bound& bound, Sums& sums)
+{
+    for (size_t i = 0; i < size; i += BoundBlockSize)
+    {
+        auto count = std::min(BoundBlockSize, size - i);
+
+        SumsScalar(a + i, b + i, count, sums);
+
+        if (i + count < size)
+        {
+            auto lower = CheckBound(bound, sums, size - i - count);
+
+            if (lower >= 0.0)
+                return lower;
+        }
+    }
+
+    return -1.0;
+}
+
+/**
+ * Add one pair of elements to the sums.
+ */
+inline void AddElements(int x, int y, Sums& sums)
+{
+    int d = x - y;
+
+    sums.aa += x * x;
+    sums.bb += y * y;
+    sums.dd += d * d;
+}
+
+void SumsCompressedScalar(const signed char* split, size_t plane_size,
+                          const unsigned char* data, size_t count, Sums& sums)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned int x = data[i] & 0x7f;
+
+        AddElements(split[i], static_cast<int>(x % 5) - 2, sums);
+        AddElements(split[plane_size + i], static_cast<int>(x / 5 % 5) - 2,
+                    sums);
+        AddElements(split[2 * plane_size + i],
+                    static_cast<int>(x / 25 % 5) - 2, sums);
+    }
+}
+
+double CompressedScalar(const signed char* split, size_t plane_size,
+                        const unsigned char* data, size_t count, size_t size,
+                        const Bound& bound, Sums& sums)
+{
+    for (size_t i = 0; i < count; i += CompressedBlockSize)
+    {
+        auto block = std::min(CompressedBlockSize, count - i);
+
+        SumsCompressedScalar(split + i, plane_size, data + i, block, sums);
+
+        if (i + block < count)
+        {
+            auto lower = CheckBound(bound, sums, size - 3 * (i + block));
+
+            if (lower >= 0.0)
+                return lower;
+        }
+    }
+
+    return -1.0;
+}
+
+#ifdef OFN_DISTANCE_X86
+
+__attribute__((target("sse4.1")))
+uint32_t HorizontalSum(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(v));
+}
+
+__attribute__((target("sse4.1")))
+void SumsSSE41(const signed char* a, const signed char* b, size_t size,
+               Sums& sums)
+{
+    __m128i aa = _mm_setzero_si128();
+    __m128i bb = _mm_setzero_si128();
+    __m128i dd = _mm_setzero_si128();
+    size_t i = 0;
+
+    // Widen 8 elements at a time to 16 bits and let madd square and pairwise
+    // add them into 32-bit lanes.
+    for (; i + 8 <= size; i += 8)
+    {
+        auto x = _mm_cvtepi8_epi16(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + i)));
+        auto y = _mm_cvtepi8_epi16(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + i)));
+        auto d = _mm_sub_epi16(x, y);
+
+        aa = _mm_add_epi32(aa, _mm_madd_epi16(x, x));
+        bb = _mm_add_epi32(bb, _mm_madd_epi16(y, y));
+        dd = _mm_add_epi32(dd, _mm_madd_epi16(d, d));
+    }
+
+    sums.aa += HorizontalSum(aa);
+    sums.bb += HorizontalSum(bb);
+    sums.dd += HorizontalSum(dd);
+
+    SumsScalar(a + i, b + i, size - i, sums);
+}
+
+__attribute__((target("sse4.1")))
+double BoundedSSE41(const signed char* a, const signed char* b, size_t size,
+                    const Bound& bound, Sums& sums)
+{
+    __m128i aa = _mm_setzero_si128();
+    __m128i bb = _mm_setzero_si128();
+    __m128i dd = _mm_setzero_si128();
+    auto lengths = bound.NeedsLengths();
+    size_t i = 0;
+
+    while (i + 8 <= size)
+    {
+        auto x = _mm_cvtepi8_epi16(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + i)));
+        auto y = _mm_cvtepi8_epi16(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + i)));
+        auto d = _mm_sub_epi16(x, y);
+
+        aa = _mm_add_epi32(aa, _mm_madd_epi16(x, x));
+        bb = _mm_add_epi32(bb, _mm_madd_epi16(y, y));
+        dd = _mm_add_epi32(dd, _mm_madd_epi16(d, d));
+
+        i += 8;
+
+        // Only the lanes needed by the bound are reduced at each check.
+        if (i % BoundBlockSize == 0 && i < size)
+        {
+            Sums partial{ 0, 0, HorizontalSum(dd) };
+
+            if (lengths)
+            {
+                partial.aa = HorizontalSum(aa);
+                partial.bb = HorizontalSum(bb);
+            }
+
+            auto lower = CheckBound(bound, partial, size - i);
+
+            if (lower >= 0.0)
+                return lower;
+        }
+    }
+
+    sums.aa += HorizontalSum(aa);
+    sums.bb += HorizontalSum(bb);
+    sums.dd += HorizontalSum(dd);
+
+    SumsScalar(a + i, b + i, size - i, sums);
+
+    return -1.0;
+}
+
+__attribute__((target("sse4.1")))
+inline void AddLanes(__m128i x, __m128i y, __m128i& aa, __m128i& bb,
+                     __m128i& dd)
+{
+    auto d = _mm_sub_epi16(x, y);
+
+    aa = _mm_add_epi32(aa, _mm_madd_epi16(x, x));
+    bb = _mm_add_epi32(bb, _mm_madd_epi16(y, y));
+    dd = _mm_add_epi32(dd, _mm_madd_epi16(d, d));
+}
+
+/**
+ * Decode compressed bytes widened to 16-bit lanes into the values of each of
+ * their three digits.
+ */
+__attribute__((target("sse4.1")))
+inline void DecodeLanes(__m128i x, __m128i values[3])
+{
+    const auto two = _mm_set1_epi16(2);
+    const auto four = _mm_set1_epi16(4);
+    const auto five = _mm_set1_epi16(5);
+
+    x = _mm_and_si128(x, _mm_set1_epi16(0x7f));
+
+    auto q1 = _mm_mulhi_epu16(x, _mm_set1_epi16(DivideBy5));
+    auto q2 = _mm_mulhi_epu16(x, _mm_set1_epi16(DivideBy25));
+
+    // The last digit wraps like x / 25 % 5 for the bytes of 125 and above.
+    auto d0 = _mm_sub_epi16(x, _mm_mullo_epi16(q1, five));
+    auto d1 = _mm_sub_epi16(q1, _mm_mullo_epi16(q2, five));
+    auto d2 =
+        _mm_sub_epi16(q2, _mm_and_si128(_mm_cmpgt_epi16(q2, four), five));
+
+    values[0] = _mm_sub_epi16(d0, two);
+    values[1] = _mm_sub_epi16(d1, two);
+    values[2] = _mm_sub_epi16(d2, two);
+}
+
+__attribute__((target("sse4.1")))
+double CompressedSSE41(const signed char* split, size_t plane_size,
+                       const unsigned char* data, size_t count, size_t size,
+                       const Bound& bound, Sums& sums)
+{
+    __m128i aa = _mm_setzero_si128();
+    __m128i bb = _mm_setzero_si128();
+    __m128i dd = _mm_setzero_si128();
+    __m128i values[3];
+    auto lengths = bound.NeedsLengths();
+    size_t i = 0;
+
+    while (i + 8 <= count)
+    {
+        DecodeLanes(_mm_cvtepu8_epi16(_mm_loadl_epi64(
+                        reinterpret_cast<const __m128i*>(data + i))),
+                    values);
+
+        for (size_t plane = 0; plane < 3; plane++)
+        {
+            auto x = _mm_cvtepi8_epi16(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(
+                    split + plane * plane_size + i)));
+
+            AddLanes(x, values[plane], aa, bb, dd);
+        }
+
+        i += 8;
+
+        if (i % CompressedBlockSize == 0 && i < count)
+        {
+            Sums partial{ 0, 0, HorizontalSum(dd) };
+
+            if (lengths)
+            {
+                partial.aa = HorizontalSum(aa);
+                partial.bb = HorizontalSum(bb);
+            }
+
+            auto lower = CheckBound(bound, partial, size - 3 * i);
+
+            if (lower >= 0.0)
+                return lower;
+        }
+    }
+
+    sums.aa += HorizontalSum(aa);
+    sums.bb += HorizontalSum(bb);
+    sums.dd += HorizontalSum(dd);
+
+    SumsCompressedScalar(split + i, plane_size, data + i, count - i, sums);
+
+    return -1.0;
+}
+
+__attribute__((target("avx2")))
+uint32_t HorizontalSum(__m256i v)
+{
+    auto sum = _mm_add_epi32(_mm256_castsi256_si128(v),
+                             _mm256_extracti128_si256(v, 1));
+
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(sum));
+}
+
+__attribute__((target("avx2")))
+void SumsAVX2(const signed char* a, const signed char* b, size_t size,
+              Sums& sums)
+{
+    __m256i aa = _mm256_setzero_si256();
+    __m256i bb = _mm256_setzero_si256();
+    __m256i dd = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        auto x = _mm256_cvtepi8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        auto y = _mm256_cvtepi8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        auto d = _mm256_sub_epi16(x, y);
+
+        aa = _mm256_add_epi32(aa, _mm256_madd_epi16(x, x));
+        bb = _mm256_add_epi32(bb, _mm256_madd_epi16(y, y));
+        dd = _mm256_add_epi32(dd, _mm256_madd_epi16(d, d));
+    }
+
+    sums.aa += HorizontalSum(aa);
+    sums.bb += HorizontalSum(bb);
+    sums.dd += HorizontalSum(dd);
+
+    SumsScalar(a + i, b + i, size - i, sums);
+}
+
+__attribute__((target("avx2")))
+double BoundedAVX2(const signed char* a, const signed char* b, size_t size,
+                   const Bound& bound, Sums& sums)
+{
+    __m256i aa = _mm256_setzero_si256();
+    __m256i bb = _mm256_setzero_si256();
+    __m256i dd = _mm256_setzero_si256();
+    auto lengths = bound.NeedsLengths();
+    size_t i = 0;
+
+    while (i + 16 <= size)
+    {
+        auto x = _mm256_cvtepi8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        auto y = _mm256_cvtepi8_epi16(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        auto d = _mm256_sub_epi16(x, y);
+
+        aa = _mm256_add_epi32(aa, _mm256_madd_epi16(x, x));
+        bb = _mm256_add_epi32(bb, _mm256_madd_epi16(y, y));
+        dd = _mm256_add_epi32(dd, _mm256_madd_epi16(d, d));
+
+        i += 16;
+
+        if (i % BoundBlockSize == 0 && i < size)
+        {
+            Sums partial{ 0, 0, HorizontalSum(dd) };
+
+            if (lengths)
+            {
+                partial.aa = HorizontalSum(aa);
+                partial.bb = HorizontalSum(bb);
+            }
+
+            auto lower = CheckBound(bound, partial, size - i);
+
+            if (lower >= 0.0)
+                return lower;
+        }
+    }
+
+    sums.aa += HorizontalSum(aa);
+    sums.bb += HorizontalSum(bb);
+    sums.dd += HorizontalSum(dd);
+
+    SumsScalar(a + i, b + i, size - i, sums);
+
+    return -1.0;
+}
+
+__attribute__((target("avx2")))
+inline void AddLanes(__m256i x, __m256i y, __m256i& aa, __m256i& bb,
+                     __m256i& dd)
+{
+    auto d = _mm256_sub_epi16(x, y);
+
+    aa = _mm256_add_epi32(aa, _mm256_madd_epi16(x, x));
+    bb = _mm256_add_epi32(bb, _mm256_madd_epi16(y, y));
+    dd = _mm256_add_epi32(dd, _mm256_madd_epi16(d, d));
+}
+
+__attribute__((target("avx2")))
+inline void DecodeLanes(__m256i x, __m256i values[3])
+{
+    const auto two = _mm256_set1_epi16(2);
+    const auto four = _mm256_set1_epi16(4);
+    const auto five = _mm256_set1_epi16(5);
+
+    x = _mm256_and_si256(x, _mm256_set1_epi16(0x7f));
+
+    auto q1 = _mm256_mulhi_epu16(x, _mm256_set1_epi16(DivideBy5));
+    auto q2 = _mm256_mulhi_epu16(x, _mm256_set1_epi16(DivideBy25));
+    auto d0 = _mm256_sub_epi16(x, _mm256_mullo_epi16(q1, five));
+    auto d1 = _mm256_sub_epi16(q1, _mm256_mullo_epi16(q2, five));
+    auto d2 = _mm256_sub_epi16(
+        q2, _mm256_and_si256(_mm256_cmpgt_epi16(q2, four), five));
+
+    values[0] = _mm256_sub_epi16(d0, two);
+    values[1] = _mm256_sub_epi16(d1, two);
+    values[2] = _mm256_sub_epi16(d2, two);
+}
+
+__attribute__((target("avx2")))
+double CompressedAVX2(const signed char* split, size_t plane_size,
+                      const unsigned char* data, size_t count, size_t size,
+                      const Bound& bound, Sums& sums)
+{
+    __m256i aa = _mm256_setzero_si256();
+    __m256i bb = _mm256_setzero_si256();
+    __m256i dd = _mm256_setzero_si256();
+    __m256i values[3];
+    auto lengths = bound.NeedsLengths();
+    size_t i = 0;
+
+    while (i + 16 <= count)
+    {
+        DecodeLanes(_mm256_cvtepu8_epi16(_mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(data + i))),
+                    values);
+
+        for (size_t plane = 0; plane < 3; plane++)
+        {
+            auto x = _mm256_cvtepi8_epi16(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                    split + plane * plane_size + i)));
+
+            AddLanes(x, values[plane], aa, bb, dd);
+        }
+
+        i += 16;
+
+        if (i % CompressedBlockSize == 0 && i < count)
+        {
+            Sums partial{ 0, 0, HorizontalSum(dd) };
+
+            if (lengths)
+            {
+                partial.aa = HorizontalSum(aa);
+                partial.bb = HorizontalSum(bb);
+            }
+
+            auto lower = CheckBound(bound, partial, size - 3 * i);
+
+            if (lower >= 0.0)
+                return lower;
+        }
+    }
+
+    sums.aa += HorizontalSum(aa);
+    sums.bb += HorizontalSum(bb);
+    sums.dd += HorizontalSum(dd);
+
+    SumsCompressedScalar(split + i, plane_size, data + i, count - i, sums);
+
+    return -1.0;
+}
+
+#endif
+
+DistanceKernel DetectKernel()
+{
+#ifdef OFN_DISTANCE_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return DistanceKernel::AVX2;
+
+    if (__builtin_cpu_supports("sse4.1"))
+        return DistanceKernel::SSE41;
+#endif
+
+    return DistanceKernel::Scalar;
+}
+
+/**
+ * The functions of one distance kernel.
+ */
+struct KernelFuncs
+{
+    SumsFunc sums;
+    BoundedFunc bounded;
+    CompressedFunc compressed;
+};
+
+KernelFuncs GetKernelFuncs(DistanceKernel kernel)
+{
+    switch (kernel)
+    {
+#ifdef OFN_DISTANCE_X86
+    case DistanceKernel::AVX2:
+        return { SumsAVX2, BoundedAVX2, CompressedAVX2 };
+    case DistanceKernel::SSE41:
+        return { SumsSSE41, BoundedSSE41, CompressedSSE41 };
+#endif
+    default:
+        return { SumsScalar, BoundedScalar, CompressedScalar };
+    }
+}
+
+/**
+ * Get the functions of the kernel selected for the running CPU.
+ */
+const KernelFuncs& GetFuncs()
+{
+    static const KernelFuncs funcs = GetKernelFuncs(GetDistanceKernel());
+
+    return funcs;
+}
+
+inline double Finalize(const Sums& sums)
+{
+    // Same operation order as libpuzzle: |a - b| / (|a| + |b|).
+    auto length = std::sqrt(static_cast<double>(sums.aa)) +
+                  std::sqrt(static_cast<double>(sums.bb));
+
+    if (length == 0.0)
+        return 0.0;
+
+    return std::sqrt(static_cast<double>(sums.dd)) / length;
+}
+
+/**
+ * Make the bound for a cutoff and the squared lengths of the vectors.
+ */
+Bound MakeBound(double cutoff, uint64_t a_length, uint64_t b_length)
+{
+    Bound bound{ cutoff * cutoff, -1.0, -1.0 };
+
+    if (a_length != UnknownLength)
+        bound.a_length = std::sqrt(static_cast<double>(a_length));
+
+    if (b_length != UnknownLength)
+        bound.b_length = std::sqrt(static_cast<double>(b_length));
+
+    return bound;
+}
+
+double DistanceBounded(const KernelFuncs& funcs, const signed char* a,
+                       const signed char* b, size_t size, double cutoff,
+                       uint64_t a_length, uint64_t b_length)
+{
+    Sums sums{ 0, 0, 0 };
+    auto lower = funcs.bounded(a, b, size,
+                               MakeBound(cutoff, a_length, b_length), sums);
+
+    if (lower >= 0.0)
+        return std::max(cutoff, lower);
+
+    return Finalize(sums);
+}
+
+bool DistanceCompressed(const KernelFuncs& funcs, const signed char* split,
+                        size_t size, const void* data, size_t data_size,
+                        double cutoff, double& distance, uint64_t a_length,
+                        uint64_t b_length)
+{
+    if (size == 0 || GetUncompressedSize(data, data_size) != size)
+        return false;
+
+    auto bytes = static_cast<const unsigned char*>(data);
+    auto plane_size = GetSplitPlaneSize(size);
+    auto whole = size / CompressedValuesPerByte;
+    Sums sums{ 0, 0, 0 };
+    auto lower = funcs.compressed(split, plane_size, bytes, whole, size,
+                                  MakeBound(cutoff, a_length, b_length),
+                                  sums);
+
+    if (lower >= 0.0)
+    {
+        distance = std::max(cutoff, lower);
+        return true;
+    }
+
+    // The values of a trailing partial byte are at the end of the first
+    // planes.
+    if (auto trailing = size % CompressedValuesPerByte)
+    {
+        unsigned int x = bytes[whole] & 0x7f;
+
+        for (size_t i = 0; i < trailing; i++, x /= 5)
+            AddElements(split[i * plane_size + whole],
+                        static_cast<int>(x % 5) - 2, sums);
+    }
+
+    distance = Finalize(sums);
+
+    return true;
+}
+
+/**
+ * Compute the normalized distance the way
+ * `puzzle_vector_normalized_distance` does, summing in doubles.
+ */
+double ReferenceDistance(const signed char* a, const signed char* b,
+                         size_t size)
+{
+    double aa = 0.0, bb = 0.0, dd = 0.0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        double x = a[i], y = b[i];
+
+        aa += x * x;
+        bb += y * y;
+        dd += (x - y) * (x - y);
+    }
+
+    if (aa == 0.0 && bb == 0.0)
+        return 0.0;
+
+    return std::sqrt(dd) / (std::sqrt(aa) + std::sqrt(bb));
+}
+
+/**
+ * Compress a vector the way `puzzle_compress_cvec` does.
+ */
+void CompressVector(const signed char* vec, size_t size,
+                    std::vector<unsigned char>& data)
+{
+    static const unsigned char Powers[] = { 1, 5, 25 };
+
+    data.assign((size + 2) / 3, 0);
+
+    for (size_t i = 0; i < size; i++)
+        data[i / 3] += static_cast<unsigned char>((vec[i] + 2) * Powers[i % 3]);
+
+    // The number of values in a trailing partial byte is kept in the top bits
+    // of the first two bytes.
+    if (auto trailing = size % 3)
+        data[trailing - 1] |= 0x80;
+}
+
+/**
+ * Check that a distance abandoned at a cutoff is consistent with the exact
+ * one, and that a distance computed in full is identical to it.
+ */
+bool CheckCutoff(double distance, double cutoff, double expected)
+{
+    if (distance < cutoff)
+        return distance == expected;
+
+    return expected >= cutoff;
+}
+
+}
+
+DistanceKernel OFN::Puzzle::GetDistanceKernel()
+{
+    static const DistanceKernel kernel = DetectKernel();
+
+    return kernel;
+}
+
+bool OFN::Puzzle::IsDistanceKernelSupported(DistanceKernel kernel)
+{
+    // Every CPU that supports a kernel also supports the ones before it.
+    return static_cast<int>(kernel) <=
+           static_cast<int>(GetDistanceKernel());
+}
+
+const char* OFN::Puzzle::GetDistanceKernelName(DistanceKernel kernel)
+{
+    switch (kernel)
+    {
+    case DistanceKernel::AVX2:
+        return "avx2";
+    case DistanceKernel::SSE41:
+        return "sse4.1";
+    default:
+        return "scalar";
+    }
+}
+
+double OFN::Puzzle::NormalizedDistance(const signed char* a,
+                                       const signed char* b, size_t size)
+{
+    Sums sums{ 0, 0, 0 };
+
+    GetFuncs().sums(a, b, size, sums);
+
+    return Finalize(sums);
+}
+
+double OFN::Puzzle::NormalizedDistanceBounded(const signed char* a,
+                                              const signed char* b,
+                                              size_t size, double cutoff,
+                                              uint64_t a_length,
+                                              uint64_t b_length)
+{
+    return DistanceBounded(GetFuncs(), a, b, size, cutoff, a_length,
+                           b_length);
+}
+
+void OFN::Puzzle::SplitVector(const signed char* vec, size_t size,
+                              signed char* split)
+{
+    auto plane_size = GetSplitPlaneSize(size);
+
+    memset(split, 0, 3 * plane_size);
+
+    for (size_t i = 0; i < size; i++)
+        split[i % 3 * plane_size + i / 3] = vec[i];
+}
+
+bool OFN::Puzzle::NormalizedDistanceCompressed(const signed char* split,
+                                               size_t size, const void* data,
+                                               size_t data_size, double cutoff,
+                                               double& distance,
+                                               uint64_t a_length,
+                                               uint64_t b_length)
+{
+    return DistanceCompressed(GetFuncs(), split, size, data, data_size,
+                              cutoff, distance, a_length, b_length);
+}
+
+void OFN::Puzzle::NormalizedDistances(const signed char* query,
+                                      const signed char* block, size_t size,
+                                      size_t stride, size_t count,
+                                      double* distances)
+{
+    auto sums_func = GetFuncs().sums;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Sums sums{ 0, 0, 0 };
+
+        sums_func(query, block + i * stride, size, sums);
+        distances[i] = Finalize(sums);
+    }
+}
+
+bool OFN::Puzzle::CheckDistanceKernel(DistanceKernel kernel, size_t trials)
+{
+    auto funcs = GetKernelFuncs(kernel);
+    std::mt19937 random(KernelCheckSeed);
+    std::uniform_int_distribution<int> values(-2, 2);
+    std::uniform_int_distribution<size_t> sizes(4, MaxCheckSize);
+    std::uniform_real_distribution<double> cutoffs(0.0, 1.0);
+    std::vector<signed char> a, b, split;
+    std::vector<unsigned char> data;
+
+    for (size_t trial = 0; trial < trials; trial++)
+    {
+        // Every small size is covered, so each kernel's tail handling meets
+        // every remainder of its vector width.
+        size_t size = trial + 4 < 100 ? trial + 4 : sizes(random);
+        uint64_t a_length = 0, b_length = 0;
+
+        a.resize(size);
+        b.resize(size);
+
+        for (size_t i = 0; i < size; i++)
+        {
+            a[i] = static_cast<signed char>(values(random));
+
+            // Most pairs are made similar, so that cutoffs are also met
+            // without being reached.
+            if (trial % 2 == 0 && values(random) != 0)
+                b[i] = a[i];
+            else
+                b[i] = static_cast<signed char>(values(random));
+
+            a_length += a[i] * a[i];
+            b_length += b[i] * b[i];
+        }
+
+        auto expected = ReferenceDistance(a.data(), b.data(), size);
+        auto cutoff = cutoffs(random);
+        Sums sums{ 0, 0, 0 };
+        double distance;
+
+        funcs.sums(a.data(), b.data(), size, sums);
+
+        if (Finalize(sums) != expected)
+            return false;
+
+        if (DistanceBounded(funcs, a.data(), b.data(), size, 2.0,
+                            UnknownLength, UnknownLength) != expected)
+            return false;
+
+        distance = DistanceBounded(funcs, a.data(), b.data(), size, cutoff,
+                                   UnknownLength, UnknownLength);
+
+        if (!CheckCutoff(distance, cutoff, expected))
+            return false;
+
+        distance = DistanceBounded(funcs, a.data(), b.data(), size, cutoff,
+                                   a_length, b_length);
+
+        if (!CheckCutoff(distance, cutoff, expected))
+            return false;
+
+        split.resize(3 * GetSplitPlaneSize(size));
+        SplitVector(a.data(), size, split.data());
+        CompressVector(b.data(), size, data);
+
+        if (!DistanceCompressed(funcs, split.data(), size, data.data(),
+                                data.size(), 2.0, distance, UnknownLength,
+                                UnknownLength) ||
+            distance != expected)
+            return false;
+
+        if (!DistanceCompressed(funcs, split.data(), size, data.data(),
+                                data.size(), cutoff, distance, a_length,
+                                b_length) ||
+            !CheckCutoff(distance, cutoff, expected))
+            return false;
+    }
+
+    return true;
+}
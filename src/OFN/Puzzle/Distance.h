@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#pragma once
+
+/**
+ * @file Distance.h
+ * @date 16 Oct 2026
+ * @brief Vectorized normalized distance between cvecs.
+ * @author Mikkel Kroman
+ *
+ * The normalized distance is `|a - b| / (|a| + |b|)`, the same measure that
+ * `puzzle_vector_normalized_distance` computes without text fixing. Every cvec
+ * element is a small integer, so the three sums of squares are accumulated
+ * exactly in 32-bit integers and only converted to doubles for the final
+ * square roots and division. libpuzzle sums the same integer squares in
+ * doubles, which is also exact, so the results are bit-for-bit identical.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+namespace OFN
+{
+namespace Puzzle
+{
+
+/** Marks a squared vector length that isn't known. */
+static const uint64_t UnknownLength = ~uint64_t(0);
+
+/**
+ * The distance kernel implementations.
+ */
+enum class DistanceKernel
+{
+    Scalar,
+    SSE41,
+    AVX2
+};
+
+/**
+ * Get the kernel selected for the running CPU.
+ *
+ * @returns the best supported kernel.
+ */
+DistanceKernel GetDistanceKernel();
+
+/**
+ * Check whether the running CPU supports a kernel.
+ */
+bool IsDistanceKernelSupported(DistanceKernel kernel);
+
+/**
+ * Get the name of a distance kernel.
+ */
+const char* GetDistanceKernelName(DistanceKernel kernel);
+
+/**
+ * Check a kernel against the double-precision sums of
+ * `puzzle_vector_normalized_distance`.
+ *
+ * Random vectors of values in -2..2 are compared in full, with and without
+ * cutoffs and known lengths, and compressed the way `puzzle_compress_cvec`
+ * compresses them. Their sizes include every size below 100 and are mostly
+ * not a multiple of the kernel's vector width.
+ *
+ * @param kernel a kernel the running CPU supports
+ * @param trials the number of vector pairs to compare
+ *
+ * @returns true if every distance is identical to the reference, and every
+ * abandoned distance is at least the cutoff.
+ */
+bool CheckDistanceKernel(DistanceKernel kernel, size_t trials);
+
+/**
+ * Compute the normalized distance between two vectors.
+ *
+ * @param a    the first vector
+ * @param b    the second vector
+ * @param size the number of elements in each vector
+ *
+ * @returns the normalized distance, or 0.0 if both vectors are all zeroes.
+ */
+double NormalizedDistance(const signed char* a, const signed char* b,
+                          size_t size);
+
+/**
+ * Compute the normalized distance between two vectors, giving up as soon as
+ * it provably reaches a cutoff.
+ *
+ * The elements are summed a block at a time. After each block, the partial
+ * squared distance over the largest possible sum of the two lengths bounds the
+ * distance from below. A known length, such as the one stored in a sketch, is
+ * used as is, and an unknown one is bounded by taking every remaining element
+ * to be 2, the largest magnitude in a cvec.
+ *
+ * @param a        the first vector
+ * @param b        the second vector
+ * @param size     the number of elements in each vector
+ * @param cutoff   the distance the vectors have to stay under
+ * @param a_length the squared length of the first vector, or UnknownLength
+ * @param b_length the squared length of the second vector, or UnknownLength
+ *
+ * @returns the normalized distance, or a lower bound of at least the cutoff if
+ * the computation was abandoned.
+ */
+double NormalizedDistanceBounded(const signed char* a, const signed char* b,
+                                 size_t size, double cutoff,
+                                 uint64_t a_length = UnknownLength,
+                                 uint64_t b_length = UnknownLength);
+
+/**
+ * Get the number of elements in each plane of a split vector.
+ *
+ * @param size the number of elements in the vector
+ */
+inline size_t GetSplitPlaneSize(size_t size)
+{
+    return (size + 2) / 3;
+}
+
+/**
+ * Split a vector into three planes, holding the first, second and third
+ * element of every group of three, in the order a compressed vector stores
+ * them as the digits of its bytes.
+ *
+ * @param vec   the vector
+ * @param size  the number of elements
+ * @param split the array of 3 * GetSplitPlaneSize(size) elements to write to
+ */
+void SplitVector(const signed char* vec, size_t size, signed char* split);
+
+/**
+ * Compute the normalized distance between a vector and a compressed vector,
+ * giving up as soon as it provably reaches a cutoff.
+ *
+ * The compressed bytes are decoded in registers as they are read, and each
+ * digit is paired with the element of the split vector's matching plane, so
+ * the compressed vector is never written out in full, and not read at all past
+ * the point where the distance reaches the cutoff. A distance computed in full
+ * is the same as that of NormalizedDistance on the uncompressed vector.
+ *
+ * @param split     the uncompressed vector, split by SplitVector
+ * @param size      the number of elements in the uncompressed vector
+ * @param data      the compressed vector, as written by
+ *                  `puzzle_compress_cvec`
+ * @param data_size the size of the compressed vector in bytes
+ * @param cutoff    the distance the vectors have to stay under
+ * @param distance  set to the normalized distance, or a lower bound of at
+ *                  least the cutoff if the computation was abandoned
+ * @param a_length  the squared length of the uncompressed vector, or
+ *                  UnknownLength
+ * @param b_length  the squared length of the compressed vector, or
+ *                  UnknownLength
+ *
+ * @returns true on success, false if the compressed vector is malformed or
+ * doesn't have `size` elements.
+ */
+bool NormalizedDistanceCompressed(const signed char* split, size_t size,
+                                  const void* data, size_t data_size,
+                                  double cutoff, double& distance,
+                                  uint64_t a_length = UnknownLength,
+                                  uint64_t b_length = UnknownLength);
+
+/**
+ * Compute the normalized distance between a query and a block of vectors.
+ *
+ * @param query     the query vector
+ * @param block     the first vector in the block
+ * @param size      the number of elements in each vector
+ * @param stride    the distance in bytes between consecutive vectors
+ * @param count     the number of vectors in the block
+ * @param distances the array of `count` results to write to
+ */
+void NormalizedDistances(const signed char* query, const signed char* block,
+                         size_t size, size_t stride, size_t count,
+                         double* distances);
+
+}
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include <cmath>
+#include <cstring>
+
+#include "OFN/Puzzle/Sketch.h"
+
+using namespace OFN::Puzzle;
+
+void OFN::Puzzle::ComputeSketch(const signed char* vec, size_t size,
+                                uint64_t* sketch)
+{
+    auto words = GetSketchPlaneWords(size);
+    auto nonzero = sketch + 1;
+    auto positive = nonzero + words;
+    uint64_t length = 0;
+
+    memset(nonzero, 0, 2 * words * sizeof(uint64_t));
+
+    for (size_t i = 0; i < size; i++)
+    {
+        auto bit = uint64_t(1) << (i % 64);
+
+        if (vec[i] != 0)
+            nonzero[i / 64] |= bit;
+
+        if (vec[i] > 0)
+            positive[i / 64] |= bit;
+
+        length += vec[i] * vec[i];
+    }
+
+    sketch[0] = length;
+}
+
+double OFN::Puzzle::SketchLowerBound(const uint64_t* a, const uint64_t* b,
+                                     size_t words)
+{
+    auto a_nonzero = a + 1, a_positive = a_nonzero + words;
+    auto b_nonzero = b + 1, b_positive = b_nonzero + words;
+    uint64_t distance = 0;
+
+    for (size_t i = 0; i < words; i++)
+    {
+        // Exactly one of the elements is zero.
+        auto zero = a_nonzero[i] ^ b_nonzero[i];
+        // Both are non-zero, with opposite signs.
+        auto opposite =
+            a_nonzero[i] & b_nonzero[i] & (a_positive[i] ^ b_positive[i]);
+
+        distance += __builtin_popcountll(zero) +
+                    4 * __builtin_popcountll(opposite);
+    }
+
+    auto length = std::sqrt(static_cast<double>(a[0])) +
+                  std::sqrt(static_cast<double>(b[0]));
+
+    if (length == 0.0)
+        return 0.0;
+
+    return std::sqrt(static_cast<double>(distance)) / length;
+}
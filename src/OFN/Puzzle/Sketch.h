@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#pragma once
+
+/**
+ * @file Sketch.h
+ * @date 16 Oct 2026
+ * @brief Packed sign-bit sketches of cvecs.
+ * @author Mikkel Kroman
+ *
+ * A sketch packs the non-zero and the positive bit of every cvec element into
+ * two planes of 64-bit words, preceded by the squared euclidean length of the
+ * cvec. Elements whose signs differ contribute at least 1 to the squared
+ * distance if one of them is zero, and at least 4 if the signs are opposite,
+ * so a few popcounts give a lower bound on the normalized distance. The bound
+ * never exceeds the real distance, so rejecting candidates with it never
+ * loses a match.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+namespace OFN
+{
+namespace Puzzle
+{
+
+/**
+ * Get the number of 64-bit words in one plane of a sketch.
+ *
+ * @param size the number of elements in the cvec
+ */
+inline size_t GetSketchPlaneWords(size_t size)
+{
+    return (size + 63) / 64;
+}
+
+/**
+ * Get the number of 64-bit words in a sketch.
+ *
+ * @param size the number of elements in the cvec
+ */
+inline size_t GetSketchWords(size_t size)
+{
+    return 1 + 2 * GetSketchPlaneWords(size);
+}
+
+/**
+ * Compute the sketch of a cvec.
+ *
+ * @param vec    the cvec elements
+ * @param size   the number of elements
+ * @param sketch the array of GetSketchWords(size) words to write to
+ */
+void ComputeSketch(const signed char* vec, size_t size, uint64_t* sketch);
+
+/**
+ * Compute a lower bound on the normalized distance between two cvecs from
+ * their sketches.
+ *
+ * @param a     the first sketch
+ * @param b     the second sketch
+ * @param words the number of words in one plane
+ *
+ * @returns a value that is never greater than the normalized distance.
+ */
+double SketchLowerBound(const uint64_t* a, const uint64_t* b, size_t words);
+
+}
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include "OFN/QueryPlanner.h"
+
+using namespace OFN;
+
+PlanEstimate QueryPlanner::Plan(size_t postings, size_t candidates,
+                                size_t num_signatures,
+                                size_t num_queries) const
+{
+    PlanEstimate estimate;
+
+    estimate.postings = postings;
+    estimate.candidates = candidates;
+    estimate.words_cost = GetWordsCost(postings, candidates, candidates);
+    estimate.scan_cost =
+        GetScanCost(num_signatures, num_signatures * num_queries);
+
+    if (estimate.scan_cost < estimate.words_cost)
+        estimate.plan = SearchPlan::Scan;
+
+    return estimate;
+}
+
+const char* OFN::GetSearchPlanName(SearchPlan plan)
+{
+    switch (plan)
+    {
+    case SearchPlan::Words:
+        return "words";
+    case SearchPlan::Scan:
+        return "scan";
+    }
+
+    return "unknown";
+}
@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#pragma once
+
+/**
+ * @file QueryPlanner.h
+ * @brief Cost model for choosing how a search finds its candidates.
+ * @author Mikkel Kroman
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+namespace OFN
+{
+
+/**
+ * The ways a search can find its candidates.
+ */
+enum class SearchPlan
+{
+    /** Vote on posting lists and look up the best candidates one by one. */
+    Words,
+
+    /** Read and score every signature in the `signatures` table in order. */
+    Scan
+};
+
+/**
+ * The estimated cost of each unit of work, in microseconds.
+ */
+struct CostModel
+{
+    /** Reading one posting, i.e. one vote. */
+    double posting = 0.05;
+
+    /** Looking up a candidate by id. */
+    double fetch = 5.0;
+
+    /** Reading the next row of a sequential scan. */
+    double read = 1.0;
+
+    /** Comparing a query with a signature. */
+    double distance = 0.2;
+};
+
+/**
+ * The estimated costs of both plans, and the plan that was chosen.
+ */
+struct PlanEstimate
+{
+    SearchPlan plan = SearchPlan::Words;
+
+    /** The number of postings of the query words. */
+    size_t postings = 0;
+
+    /** The estimated number of candidates, summed over the queries. */
+    size_t candidates = 0;
+
+    double words_cost = 0;
+    double scan_cost = 0;
+};
+
+/**
+ * %QueryPlanner class.
+ *
+ * Words shared by a large part of the collection make for long posting lists
+ * and many candidates, each of which costs a random lookup. Past some point,
+ * reading every signature in order is cheaper, and it finds every match
+ * instead of only those among the best-voted candidates.
+ */
+class QueryPlanner
+{
+public:
+    /**
+     * Construct a planner.
+     *
+     * @param model the cost of each unit of work
+     */
+    QueryPlanner(const CostModel& model = CostModel()) :
+        model_(model)
+    {
+    }
+
+    /**
+     * Estimate the cost of finding candidates by word.
+     *
+     * @param postings   the number of postings read
+     * @param fetches    the number of candidates looked up
+     * @param distances  the number of distances computed
+     */
+    double GetWordsCost(size_t postings, size_t fetches,
+                        size_t distances) const
+    {
+        return postings * model_.posting + fetches * model_.fetch +
+               distances * model_.distance;
+    }
+
+    /**
+     * Estimate the cost of a sequential scan.
+     *
+     * @param rows      the number of signatures read
+     * @param distances the number of distances computed
+     */
+    double GetScanCost(size_t rows, size_t distances) const
+    {
+        return rows * model_.read + distances * model_.distance;
+    }
+
+    /**
+     * Choose the cheaper plan for a number of queries searched together.
+     *
+     * @param postings       the number of postings of the query words
+     * @param candidates     the estimated number of candidates that will be
+     *                       looked up and scored, summed over the queries
+     * @param num_signatures the number of signatures in the collection
+     * @param num_queries    the number of queries
+     */
+    PlanEstimate Plan(size_t postings, size_t candidates,
+                      size_t num_signatures, size_t num_queries) const;
+
+    /**
+     * Get the cost model.
+     */
+    const CostModel& GetCostModel() const
+    {
+        return model_;
+    }
+
+private:
+    CostModel model_;
+};
+
+/**
+ * Get the name of a search plan.
+ */
+const char* GetSearchPlanName(SearchPlan plan);
+
+}
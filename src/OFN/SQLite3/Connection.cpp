@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include "OFN/SQLite3/Connection.h"
+#include "OFN/SQLite3/Statement.h"
+
+using namespace OFN::SQLite3;
+
+void StatementReleaser::operator()(Statement* statement)
+{
+    connection->Release(statement, std::move(sql));
+}
+
+Connection::~Connection()
+{
+    // Cached statements have to be finalized before the database can be
+    // closed.
+    ClearStatementCache();
+
+    if (db_ != nullptr)
+        sqlite3_close(db_);
+}
+
+StatementPtr Connection::Prepare(const std::string& sql)
+{
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        auto it = cache_index_.find(sql);
+
+        if (it != cache_index_.end())
+        {
+            auto statement = std::move(it->second->second);
+
+            cache_.erase(it->second);
+            cache_index_.erase(it);
+            cache_stats_.hits++;
+
+            return StatementPtr(statement.release(), { this, sql });
+        }
+
+        cache_stats_.misses++;
+    }
+
+    sqlite3_stmt* result;
+
+    if (sqlite3_prepare_v2(db_, sql.c_str(), sql.size(), &result, NULL) !=
+        SQLITE_OK)
+        return StatementPtr(nullptr, { this, sql });
+
+    return StatementPtr(new Statement(result), { this, sql });
+}
+
+void Connection::Release(Statement* statement, std::string sql)
+{
+    std::unique_ptr<Statement> owned(statement);
+
+    owned->Reset();
+    owned->ClearBindings();
+
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+
+    // Another copy of the same statement is already cached if it was checked
+    // out twice at once, so this one is finalized.
+    if (cache_capacity_ == 0 || cache_index_.count(sql) != 0)
+        return;
+
+    cache_.emplace_front(std::move(sql), std::move(owned));
+    cache_index_.emplace(cache_.front().first, cache_.begin());
+
+    Evict(cache_capacity_);
+}
+
+void Connection::Configure(const ConnectionOptions& options)
+{
+    for (auto& pragma : options.GetPragmas())
+    {
+        auto sql = "PRAGMA " + pragma.first + " = " + pragma.second;
+
+        if (Execute(sql) != SQLITE_OK)
+            throw ConnectionError("Failed to set " + pragma.first + ": " +
+                                  GetErrorMessage());
+    }
+}
+
+void Connection::SetStatementCacheSize(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+
+    cache_capacity_ = capacity;
+    Evict(cache_capacity_);
+}
+
+void Connection::ClearStatementCache()
+{
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+
+    Evict(0);
+}
+
+void Connection::Evict(size_t capacity)
+{
+    while (cache_.size() > capacity)
+    {
+        cache_index_.erase(cache_.back().first);
+        cache_.pop_back();
+        cache_stats_.evictions++;
+    }
+}
@@ -24,11 +24,17 @@
  * @brief Connection class for the SQLite3 C++ wrapper.
  */
 
+#include <list>
+#include <mutex>
 #include <string>
 #include <memory>
+#include <cstdint>
+#include <unordered_map>
 #include <sqlite3.h>
 
 #include "OFN/SQLite3/Errors.h"
+#include "OFN/SQLite3/IntArray.h"
+#include "OFN/SQLite3/ConnectionOptions.h"
 
 namespace OFN
 {
@@ -36,42 +42,121 @@ namespace SQLite3
 {
 
 class Statement;
+class Connection;
+
+/**
+ * Returns a prepared statement to the statement cache of its connection
+ * instead of finalizing it.
+ */
+struct StatementReleaser
+{
+    /** The connection the statement was prepared on. */
+    Connection* connection;
+
+    /** The SQL text the statement is cached by. */
+    std::string sql;
+
+    void operator()(Statement* statement);
+};
+
+/**
+ * A prepared statement checked out from a connection.
+ *
+ * The statement is reset, its bindings are cleared and it is put back in the
+ * statement cache when the pointer goes out of scope, so it must not outlive
+ * the connection.
+ */
+using StatementPtr = std::unique_ptr<Statement, StatementReleaser>;
+
+/**
+ * Statement cache counters.
+ */
+struct StatementCacheStats
+{
+    /** The number of statements taken from the cache. */
+    uint64_t hits = 0;
+
+    /** The number of statements that had to be compiled. */
+    uint64_t misses = 0;
+
+    /** The number of cached statements finalized to make room. */
+    uint64_t evictions = 0;
+};
 
 /**
  * +Connection class.
  */
 class Connection
 {
+    friend struct StatementReleaser;
+
 public:
+    /** The default number of prepared statements kept in the cache. */
+    static const size_t DefaultStatementCacheSize = 64;
+
+    /** The flags a read-write connection is opened with. */
+    static const int ReadWrite = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+
     /**
      * Construct a new connection.
      *
      * @param filename the database filename
+     * @param flags    the `SQLITE_OPEN_*` flags to open the database with
      *
-     * @throws ConnectionError if `sqlite3_open` fails.
+     * @throws ConnectionError if `sqlite3_open_v2` fails.
      */
-    Connection(const std::string& filename) :
-        db_(nullptr)
+    Connection(const std::string& filename, int flags = ReadWrite) :
+        db_(nullptr),
+        cache_capacity_(DefaultStatementCacheSize)
     {
         sqlite3* result;
 
-        if (sqlite3_open(filename.c_str(), &result) != SQLITE_OK)
+        if (sqlite3_open_v2(filename.c_str(), &result, flags, nullptr) !=
+            SQLITE_OK)
+        {
+            // A handle is allocated even when opening fails.
+            sqlite3_close(result);
+
             throw ConnectionError("Failed to open database");
+        }
 
         db_ = result;
+
+        IntArray::Register(db_);
     }
 
     /**
-     * Destruct a connection.
+     * Construct a new connection and configure it.
      *
-     * Closes the SQLite database.
+     * @param filename the database filename
+     * @param options  the settings to apply
+     * @param flags    the `SQLITE_OPEN_*` flags to open the database with
+     *
+     * @throws ConnectionError if `sqlite3_open_v2` or applying a setting
+     * fails.
+     */
+    Connection(const std::string& filename, const ConnectionOptions& options,
+               int flags = ReadWrite) :
+        Connection(filename, flags)
+    {
+        Configure(options);
+    }
+
+    /**
+     * Check whether the connection was opened read-only.
      */
-    ~Connection()
+    bool IsReadOnly() const
     {
-        if (db_ != nullptr)
-            sqlite3_close(db_);
+        return sqlite3_db_readonly(db_, "main") == 1;
     }
 
+    /**
+     * Destruct a connection.
+     *
+     * Closes the SQLite database.
+     */
+    ~Connection();
+
     /**
      * Get the raw sqlite3 handle.
      *
@@ -92,22 +177,48 @@ public:
         sqlite3_trace(db_, f, this);
     }
 
+    /**
+     * Apply connection settings.
+     *
+     * @param options the settings to apply
+     *
+     * @throws ConnectionError if a setting cannot be applied.
+     */
+    void Configure(const ConnectionOptions& options);
+
     /**
      * Prepare a SQL statement.
      *
+     * Statements are taken from a least-recently-used cache keyed by their
+     * SQL text when possible, and are only compiled on a miss. Each cached
+     * statement can be checked out by one caller at a time.
+     *
      * @param sql the sql statement, utf-8 encoded.
      *
-     * @returns a pointer to a prepared statement.
+     * @returns a pointer to a prepared statement, or nullptr on failure.
      */
-    std::unique_ptr<Statement> Prepare(const std::string& sql)
-    {
-        sqlite3_stmt* result;
+    StatementPtr Prepare(const std::string& sql);
 
-        if (sqlite3_prepare_v2(db_, sql.c_str(), sql.size(), &result, NULL) !=
-            SQLITE_OK)
-            return nullptr;
+    /**
+     * Set the maximum number of statements kept in the statement cache.
+     *
+     * @param capacity the number of statements, or 0 to disable the cache
+     */
+    void SetStatementCacheSize(size_t capacity);
+
+    /**
+     * Finalize every statement in the statement cache.
+     */
+    void ClearStatementCache();
+
+    /**
+     * Get the statement cache counters.
+     */
+    StatementCacheStats GetStatementCacheStats() const
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
 
-        return std::make_unique<Statement>(result);
+        return cache_stats_;
     }
 
     /**
@@ -139,7 +250,27 @@ public:
     }
 
 private:
+    /**
+     * Put a statement back in the cache, evicting the least recently used
+     * statement if the cache is full.
+     */
+    void Release(Statement* statement, std::string sql);
+
+    /**
+     * Finalize cached statements until there are at most `capacity` left.
+     */
+    void Evict(size_t capacity);
+
+    using CacheEntry = std::pair<std::string, std::unique_ptr<Statement>>;
+    using CacheList = std::list<CacheEntry>;
+
     sqlite3* db_;
+
+    mutable std::mutex cache_mutex_;
+    CacheList cache_;
+    std::unordered_map<std::string, CacheList::iterator> cache_index_;
+    size_t cache_capacity_;
+    StatementCacheStats cache_stats_;
 };
 
 }
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include <cctype>
+#include <algorithm>
+
+#include "OFN/SQLite3/ConnectionOptions.h"
+
+using namespace OFN::SQLite3;
+
+bool ConnectionOptions::LoadPreset(const std::string& name)
+{
+    ConnectionOptions options;
+
+    if (name == "ingest")
+    {
+        options.journal_mode = "WAL";
+        options.synchronous = "NORMAL";
+        options.cache_size = "-65536";
+        options.temp_store = "MEMORY";
+    }
+    else if (name == "read-mostly")
+    {
+        options.journal_mode = "WAL";
+        options.synchronous = "NORMAL";
+        options.cache_size = "-131072";
+        options.mmap_size = "1073741824";
+        options.temp_store = "MEMORY";
+    }
+    else if (name != "default")
+    {
+        return false;
+    }
+
+    *this = options;
+
+    return true;
+}
+
+bool ConnectionOptions::Set(const std::string& assignment)
+{
+    auto separator = assignment.find('=');
+
+    if (separator == std::string::npos)
+        return false;
+
+    auto name = assignment.substr(0, separator);
+    auto value = assignment.substr(separator + 1);
+
+    // Values are pasted into PRAGMA statements, so only allow the words and
+    // numbers PRAGMAs take.
+    auto is_plain = [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '-' ||
+               c == '_';
+    };
+
+    if (!std::all_of(value.begin(), value.end(), is_plain))
+        return false;
+
+    if (name == "page_size")
+        page_size = value;
+    else if (name == "journal_mode")
+        journal_mode = value;
+    else if (name == "synchronous")
+        synchronous = value;
+    else if (name == "cache_size")
+        cache_size = value;
+    else if (name == "mmap_size")
+        mmap_size = value;
+    else if (name == "temp_store")
+        temp_store = value;
+    else if (name == "busy_timeout")
+        busy_timeout = value;
+    else
+        return false;
+
+    return true;
+}
+
+std::vector<std::pair<std::string, std::string>>
+ConnectionOptions::GetPragmas() const
+{
+    std::vector<std::pair<std::string, std::string>> result;
+
+    // The page size can no longer change once the database is in WAL mode,
+    // so it goes first.
+    const std::pair<const char*, const std::string*> pragmas[] = {
+        { "page_size", &page_size },     { "journal_mode", &journal_mode },
+        { "synchronous", &synchronous }, { "cache_size", &cache_size },
+        { "mmap_size", &mmap_size },     { "temp_store", &temp_store },
+        { "busy_timeout", &busy_timeout }
+    };
+
+    for (auto& pragma : pragmas)
+    {
+        if (!pragma.second->empty())
+            result.emplace_back(pragma.first, *pragma.second);
+    }
+
+    return result;
+}
+
+ConnectionOptions ConnectionOptions::GetReaderOptions() const
+{
+    auto options = *this;
+
+    options.page_size.clear();
+    options.journal_mode.clear();
+
+    return options;
+}
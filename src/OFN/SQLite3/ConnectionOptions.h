@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#pragma once
+
+/**
+ * @file ConnectionOptions.h
+ * @author Mikkel Kroman
+ * @brief Tuning options applied when opening a connection.
+ */
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace OFN
+{
+namespace SQLite3
+{
+
+/**
+ * +ConnectionOptions class.
+ *
+ * Holds the PRAGMA settings a connection is configured with when it is
+ * opened. An empty value leaves the SQLite default in place.
+ */
+struct ConnectionOptions
+{
+    /**
+     * The page size in bytes. It only takes effect before the database has
+     * any tables, or on the next VACUUM outside of WAL mode.
+     */
+    std::string page_size;
+
+    /** The journal mode, e.g. DELETE or WAL. */
+    std::string journal_mode;
+
+    /** The synchronous level, e.g. FULL or NORMAL. */
+    std::string synchronous;
+
+    /** The page cache size, in pages or in KiB when negative. */
+    std::string cache_size;
+
+    /** The maximum number of bytes of the database to memory-map. */
+    std::string mmap_size;
+
+    /** Where temporary tables and indices are kept, e.g. MEMORY. */
+    std::string temp_store;
+
+    /**
+     * How many milliseconds to wait for a lock held by another connection.
+     *
+     * The readers and the writer of a connection pool take locks of their
+     * own, so this is set for every preset; otherwise a reader would fail
+     * with SQLITE_BUSY as soon as the writer holds a lock.
+     */
+    std::string busy_timeout = "5000";
+
+    /**
+     * Replace the options with a named preset.
+     *
+     * `default` leaves every setting but the busy timeout to SQLite.
+     * `ingest` trades durability of the last transactions on power loss for
+     * commit throughput, and `read-mostly` maps and caches as much of the
+     * database as is useful for searching.
+     *
+     * @param name the name of the preset
+     *
+     * @returns true on success, false if there is no such preset.
+     */
+    bool LoadPreset(const std::string& name);
+
+    /**
+     * Set a single option from a `name=value` string.
+     *
+     * @param assignment the option and its value, e.g. `synchronous=OFF`
+     *
+     * @returns true on success, false if the option is unknown or the value
+     * is not a plain word or number.
+     */
+    bool Set(const std::string& assignment);
+
+    /**
+     * Get the options that are set, as PRAGMA names and values, in the order
+     * they have to be applied.
+     */
+    std::vector<std::pair<std::string, std::string>> GetPragmas() const;
+
+    /**
+     * Get the options for a read-only connection to the same database.
+     *
+     * The page size and journal mode belong to the database rather than the
+     * connection, so they are left to the write connection.
+     */
+    ConnectionOptions GetReaderOptions() const;
+};
+
+}
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include "OFN/SQLite3/ConnectionPool.h"
+#include "OFN/SQLite3/Statement.h"
+
+using namespace OFN::SQLite3;
+
+const int ConnectionPool::ReadOnly;
+
+ConnectionPool::ConnectionPool(const std::string& filename,
+                               const ConnectionOptions& options) :
+    filename_(filename),
+    reader_options_(options.GetReaderOptions()),
+    writer_(std::make_shared<Connection>(filename, options)),
+    trace_(nullptr)
+{
+}
+
+std::shared_ptr<Connection> ConnectionPool::GetReader()
+{
+    auto id = std::this_thread::get_id();
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = readers_.find(id);
+
+        if (it != readers_.end())
+            return it->second;
+    }
+
+    // Open the connection outside the lock, nobody else can ask for this
+    // thread's reader in the meantime.
+    auto reader =
+        std::make_shared<Connection>(filename_, reader_options_, ReadOnly);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (trace_ != nullptr)
+        reader->SetTrace(trace_);
+
+    readers_.emplace(id, reader);
+
+    return reader;
+}
+
+void ConnectionPool::ReleaseReader()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    readers_.erase(std::this_thread::get_id());
+}
+
+void ConnectionPool::SetTrace(Connection::TraceFunc trace)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    trace_ = trace;
+    writer_->SetTrace(trace);
+
+    for (auto& reader : readers_)
+        reader.second->SetTrace(trace);
+}
+
+size_t ConnectionPool::GetNumReaders() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    return readers_.size();
+}
+
+StatementCacheStats ConnectionPool::GetStatementCacheStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto result = writer_->GetStatementCacheStats();
+
+    for (auto& reader : readers_)
+    {
+        auto stats = reader.second->GetStatementCacheStats();
+
+        result.hits += stats.hits;
+        result.misses += stats.misses;
+        result.evictions += stats.evictions;
+    }
+
+    return result;
+}
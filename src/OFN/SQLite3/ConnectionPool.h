@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#pragma once
+
+/**
+ * @file ConnectionPool.h
+ * @author Mikkel Kroman
+ * @brief Pool of thread-affine read-only connections and one writer.
+ */
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "OFN/SQLite3/Connection.h"
+#include "OFN/SQLite3/ConnectionOptions.h"
+
+namespace OFN
+{
+namespace SQLite3
+{
+
+/**
+ * +ConnectionPool class.
+ *
+ * Owns the single write connection to a database and one read-only
+ * connection per thread that asks for one. A thread always gets the same
+ * reader back, so readers, and the statements in their caches, are never
+ * shared between threads. In WAL mode readers see the last committed state
+ * of the database while a write transaction is in progress.
+ *
+ * The pool itself is thread-safe. The write connection must only be used by
+ * one thread at a time.
+ */
+class ConnectionPool
+{
+public:
+    /** The flags read-only connections are opened with. */
+    static const int ReadOnly =
+        SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_PRIVATECACHE;
+
+    /**
+     * Construct a pool and open the write connection.
+     *
+     * @param filename the database filename
+     * @param options  the settings to apply to every connection
+     *
+     * @throws ConnectionError if the write connection cannot be opened.
+     */
+    ConnectionPool(const std::string& filename,
+                   const ConnectionOptions& options);
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    /**
+     * Get the database filename.
+     */
+    const std::string& GetFilename() const
+    {
+        return filename_;
+    }
+
+    /**
+     * Get the write connection.
+     */
+    std::shared_ptr<Connection> GetWriter() const
+    {
+        return writer_;
+    }
+
+    /**
+     * Get the read-only connection of the calling thread, opening it on
+     * first use.
+     *
+     * @throws ConnectionError if the connection cannot be opened.
+     */
+    std::shared_ptr<Connection> GetReader();
+
+    /**
+     * Close the read-only connection of the calling thread, if it has one.
+     *
+     * Threads that are about to exit should call this so that their
+     * connection does not stay open.
+     */
+    void ReleaseReader();
+
+    /**
+     * Set a trace function on the writer and every reader.
+     */
+    void SetTrace(Connection::TraceFunc trace);
+
+    /**
+     * Get the number of open read-only connections.
+     */
+    size_t GetNumReaders() const;
+
+    /**
+     * Get the statement cache counters summed over every connection.
+     */
+    StatementCacheStats GetStatementCacheStats() const;
+
+private:
+    std::string filename_;
+    ConnectionOptions reader_options_;
+    std::shared_ptr<Connection> writer_;
+    Connection::TraceFunc trace_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::thread::id, std::shared_ptr<Connection>> readers_;
+};
+
+}
+}
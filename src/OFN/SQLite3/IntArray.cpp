@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include <cstring>
+
+#include "OFN/SQLite3/IntArray.h"
+
+using namespace OFN::SQLite3;
+
+namespace
+{
+
+/** The columns of the table-valued function. */
+enum Column
+{
+    ColumnValue,
+    ColumnPointer
+};
+
+/**
+ * A cursor over the integers of a bound array.
+ */
+struct Cursor
+{
+    sqlite3_vtab_cursor base;
+    const IntArray* array;
+    size_t index;
+};
+
+int Connect(sqlite3* db, void* aux, int argc, const char* const* argv,
+            sqlite3_vtab** vtab, char** error)
+{
+    (void)aux;
+    (void)argc;
+    (void)argv;
+    (void)error;
+
+    auto result =
+        sqlite3_declare_vtab(db, "CREATE TABLE x(value, pointer HIDDEN)");
+
+    if (result != SQLITE_OK)
+        return result;
+
+    *vtab = static_cast<sqlite3_vtab*>(sqlite3_malloc(sizeof(sqlite3_vtab)));
+
+    if (*vtab == nullptr)
+        return SQLITE_NOMEM;
+
+    memset(*vtab, 0, sizeof(sqlite3_vtab));
+
+    return SQLITE_OK;
+}
+
+int Disconnect(sqlite3_vtab* vtab)
+{
+    sqlite3_free(vtab);
+
+    return SQLITE_OK;
+}
+
+int BestIndex(sqlite3_vtab* vtab, sqlite3_index_info* info)
+{
+    (void)vtab;
+
+    // The array can only be scanned once it has been passed as the hidden
+    // pointer argument.
+    for (int i = 0; i < info->nConstraint; i++)
+    {
+        auto& constraint = info->aConstraint[i];
+
+        if (constraint.iColumn == ColumnPointer &&
+            constraint.op == SQLITE_INDEX_CONSTRAINT_EQ && constraint.usable)
+        {
+            info->aConstraintUsage[i].argvIndex = 1;
+            info->aConstraintUsage[i].omit = 1;
+            info->idxNum = 1;
+            info->estimatedCost = 10;
+            info->estimatedRows = 100;
+
+            return SQLITE_OK;
+        }
+    }
+
+    return SQLITE_CONSTRAINT;
+}
+
+int Open(sqlite3_vtab* vtab, sqlite3_vtab_cursor** cursor)
+{
+    (void)vtab;
+
+    auto result = static_cast<Cursor*>(sqlite3_malloc(sizeof(Cursor)));
+
+    if (result == nullptr)
+        return SQLITE_NOMEM;
+
+    memset(result, 0, sizeof(Cursor));
+    *cursor = &result->base;
+
+    return SQLITE_OK;
+}
+
+int Close(sqlite3_vtab_cursor* cursor)
+{
+    sqlite3_free(cursor);
+
+    return SQLITE_OK;
+}
+
+int Filter(sqlite3_vtab_cursor* base, int idx_num, const char* idx_str,
+           int argc, sqlite3_value** argv)
+{
+    (void)idx_str;
+    auto cursor = reinterpret_cast<Cursor*>(base);
+
+    cursor->array = nullptr;
+    cursor->index = 0;
+
+    if (idx_num == 1 && argc == 1)
+        cursor->array = static_cast<const IntArray*>(
+            sqlite3_value_pointer(argv[0], IntArray::PointerType));
+
+    return SQLITE_OK;
+}
+
+int Next(sqlite3_vtab_cursor* base)
+{
+    reinterpret_cast<Cursor*>(base)->index++;
+
+    return SQLITE_OK;
+}
+
+int Eof(sqlite3_vtab_cursor* base)
+{
+    auto cursor = reinterpret_cast<Cursor*>(base);
+
+    return cursor->array == nullptr ||
+           cursor->index >= cursor->array->GetSize();
+}
+
+int GetColumn(sqlite3_vtab_cursor* base, sqlite3_context* context, int column)
+{
+    auto cursor = reinterpret_cast<Cursor*>(base);
+
+    if (column == ColumnValue)
+        sqlite3_result_int64(context, (*cursor->array)[cursor->index]);
+    else
+        sqlite3_result_null(context);
+
+    return SQLITE_OK;
+}
+
+int RowID(sqlite3_vtab_cursor* base, sqlite3_int64* rowid)
+{
+    *rowid = reinterpret_cast<Cursor*>(base)->index;
+
+    return SQLITE_OK;
+}
+
+}
+
+int IntArray::Register(sqlite3* db)
+{
+    static sqlite3_module module = [] {
+        sqlite3_module result;
+
+        // Without xCreate the table is eponymous-only, so it can only be used
+        // as a table-valued function.
+        memset(&result, 0, sizeof result);
+        result.xConnect = Connect;
+        result.xBestIndex = BestIndex;
+        result.xDisconnect = Disconnect;
+        result.xOpen = Open;
+        result.xClose = Close;
+        result.xFilter = Filter;
+        result.xNext = Next;
+        result.xEof = Eof;
+        result.xColumn = GetColumn;
+        result.xRowid = RowID;
+
+        return result;
+    }();
+
+    return sqlite3_create_module(db, FunctionName, &module, nullptr);
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#pragma once
+
+/**
+ * @file IntArray.h
+ * @author Mikkel Kroman
+ * @brief Binding a set of integers to a single statement parameter.
+ */
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <sqlite3.h>
+
+namespace OFN
+{
+namespace SQLite3
+{
+
+/**
+ * +IntArray class.
+ *
+ * A view of 64-bit integers that can be bound to one parameter of a statement
+ * and queried as the `int_array` table-valued function, e.g.
+ *
+ *     SELECT * FROM words WHERE word_key IN int_array(?)
+ *
+ * The array only points to the integers, so binding it does not copy them.
+ * The integers must stay alive and unchanged until the statement has been
+ * reset.
+ */
+class IntArray
+{
+public:
+    /** The name of the table-valued function. */
+    static constexpr const char* FunctionName = "int_array";
+
+    /** The pointer type the array is bound as. */
+    static constexpr const char* PointerType = "ofn_int_array";
+
+    /**
+     * Construct a view of a number of integers.
+     *
+     * @param values a pointer to the first integer
+     * @param size   the number of integers
+     */
+    IntArray(const int64_t* values, size_t size) :
+        values_(values),
+        size_(size)
+    {
+    }
+
+    /**
+     * Construct a view of the integers in a vector.
+     */
+    IntArray(const std::vector<int64_t>& values) :
+        IntArray(values.data(), values.size())
+    {
+    }
+
+    /**
+     * Get the number of integers.
+     */
+    size_t GetSize() const
+    {
+        return size_;
+    }
+
+    /**
+     * Get an integer.
+     */
+    int64_t operator[](size_t index) const
+    {
+        return values_[index];
+    }
+
+    /**
+     * Register the `int_array` table-valued function on a database.
+     *
+     * @returns SQLITE_OK on success, or an SQLite error code otherwise.
+     */
+    static int Register(sqlite3* db);
+
+private:
+    const int64_t* values_;
+    size_t size_;
+};
+
+}
+}
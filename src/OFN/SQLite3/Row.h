@@ -25,6 +25,7 @@
  */
 
 #include <cstddef>
+#include <cstdint>
 #include <sqlite3.h>
 
 namespace OFN
@@ -34,21 +35,30 @@ namespace SQLite3
 
 /**
  * +Data class.
+ *
+ * A non-owning view of a text or blob column. The bytes belong to the
+ * statement and are only valid until the next call to `sqlite3_step`,
+ * `sqlite3_reset` or `sqlite3_finalize` on it, or until another accessor
+ * converts the same column to a different type. Copy the bytes out if they
+ * have to outlive the row.
  */
 class Data
 {
 public:
+    Data() :
+        size_(0),
+        data_(nullptr)
+    {
+    }
+
     Data(const char* data, size_t size) :
         size_(size),
         data_(data)
     {
     }
 
-    Data(Data&& data) :
-        size_(data.size_),
-        data_(data.data_)
-    {
-    }
+    Data(const Data& data) = default;
+    Data& operator=(const Data& data) = default;
 
     const char* data() const
     {
@@ -59,7 +69,27 @@ public:
     {
         return size_;
     }
-    
+
+    bool empty() const
+    {
+        return size_ == 0;
+    }
+
+    const char* begin() const
+    {
+        return data_;
+    }
+
+    const char* end() const
+    {
+        return data_ + size_;
+    }
+
+    char operator[](size_t index) const
+    {
+        return data_[index];
+    }
+
 private:
     size_t size_;
     const char* data_;
@@ -121,13 +151,15 @@ public:
     /**
      * Get the value of a column as a 64-bit integer.
      */
-    int GetInt64(int index) const
+    int64_t GetInt64(int index) const
     {
         return sqlite3_column_int64(stmt_, index);
     }
 
     /**
      * Get the value of a column as a string.
+     *
+     * @returns a view that is valid until the statement is stepped or reset.
      */
     Data GetText(int index) const
     {
@@ -139,6 +171,8 @@ public:
 
     /**
      * Get the value of a column as a blob.
+     *
+     * @returns a view that is valid until the statement is stepped or reset.
      */
     Data GetBlob(int index) const
     {
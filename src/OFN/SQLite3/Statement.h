@@ -112,6 +112,23 @@ public:
         return sqlite3_bind_blob(stmt_, index, value, size,
                                  transient ? SQLITE_TRANSIENT : nullptr);
     }
+
+    /**
+     * Bind a set of integers to an `int_array(?)` parameter.
+     *
+     * Only a pointer to the array is bound, so the array and its integers
+     * must stay alive until the statement has been reset.
+     *
+     * @param index the parameter index
+     * @param array the integers
+     *
+     * @returns SQLITE_OK on success, or an SQLite error code otherwise.
+     */
+    int Bind(int index, const IntArray& array)
+    {
+        return sqlite3_bind_pointer(stmt_, index, const_cast<IntArray*>(&array),
+                                    IntArray::PointerType, nullptr);
+    }
     
     /**
      * Evaluate the prepared statement.
@@ -139,6 +156,14 @@ public:
         return sqlite3_reset(stmt_);
     }
 
+    /**
+     * Reset every bound parameter to NULL.
+     */
+    int ClearBindings()
+    {
+        return sqlite3_clear_bindings(stmt_);
+    }
+
     /**
      * Get a raw pointer to the statement.
      *
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include <algorithm>
+
+#include "OFN/SignatureCache.h"
+
+using namespace OFN;
+
+SignatureCache::SignatureCache(size_t budget, size_t num_shards) :
+    shards_(std::max<size_t>(num_shards, 1)),
+    budget_(budget),
+    shard_budget_(budget / shards_.size())
+{
+}
+
+SignatureCache::~SignatureCache()
+{
+}
+
+SignatureCache::Entry SignatureCache::Find(int64_t signature_id)
+{
+    auto& shard = GetShard(signature_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(signature_id);
+
+    if (it == shard.index.end())
+    {
+        shard.stats.misses++;
+
+        return nullptr;
+    }
+
+    // Move the signature to the front of the list.
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    shard.stats.hits++;
+
+    return it->second->second;
+}
+
+void SignatureCache::Insert(int64_t signature_id, Entry entry)
+{
+    auto size = GetEntrySize(*entry);
+
+    if (size > shard_budget_)
+        return;
+
+    auto& shard = GetShard(signature_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // Another search may have cached the same signature in the meantime.
+    if (shard.index.count(signature_id) != 0)
+        return;
+
+    Evict(shard, shard_budget_ - size);
+
+    shard.entries.emplace_front(signature_id, std::move(entry));
+    shard.index.emplace(signature_id, shard.entries.begin());
+    shard.stats.entries++;
+    shard.stats.size += size;
+}
+
+void SignatureCache::Clear()
+{
+    for (auto& shard : shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        shard.entries.clear();
+        shard.index.clear();
+        shard.stats.entries = 0;
+        shard.stats.size = 0;
+    }
+}
+
+SignatureCacheStats SignatureCache::GetStats() const
+{
+    SignatureCacheStats result;
+
+    for (auto& shard : shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        result.hits += shard.stats.hits;
+        result.misses += shard.stats.misses;
+        result.evictions += shard.stats.evictions;
+        result.entries += shard.stats.entries;
+        result.size += shard.stats.size;
+    }
+
+    return result;
+}
+
+void SignatureCache::Evict(Shard& shard, size_t size)
+{
+    while (shard.stats.size > size && !shard.entries.empty())
+    {
+        auto& last = shard.entries.back();
+
+        shard.stats.size -= GetEntrySize(*last.second);
+        shard.stats.entries--;
+        shard.stats.evictions++;
+        shard.index.erase(last.first);
+        shard.entries.pop_back();
+    }
+}
+
+size_t SignatureCache::GetEntrySize(const CachedSignature& entry)
+{
+    // Account for the list node and the index entry along with the payload.
+    return sizeof(CachedSignature) + 64 + entry.digest.capacity() +
+           entry.filename.capacity() + entry.sketch.capacity() +
+           entry.signature.capacity();
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#pragma once
+
+/**
+ * @file SignatureCache.h
+ * @brief Bounded cache of compressed signatures and their images.
+ * @author Mikkel Kroman
+ */
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+namespace OFN
+{
+
+/**
+ * A compressed signature together with what a match needs to report.
+ */
+struct CachedSignature
+{
+    /** The image id. */
+    int64_t image_id;
+
+    /** The raw digest of the image file. */
+    std::string digest;
+
+    /** The filename of the image. */
+    std::string filename;
+
+    /** The stored sketch, possibly empty. */
+    std::string sketch;
+
+    /**
+     * The compressed signature, scored without being uncompressed and a
+     * third of the size of the uncompressed one.
+     */
+    std::string signature;
+};
+
+/**
+ * The accumulated statistics of a signature cache.
+ */
+struct SignatureCacheStats
+{
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+
+    /** The number of cached signatures. */
+    size_t entries = 0;
+
+    /** The approximate number of bytes used by the cached signatures. */
+    size_t size = 0;
+};
+
+/**
+ * %SignatureCache class.
+ *
+ * Maps signature ids to compressed signatures, so candidates that show up
+ * in search after search aren't read from the database again. The cache is
+ * split into shards by signature id, each with its own lock and
+ * least-recently-used list, and each holding an equal part of the memory
+ * budget.
+ *
+ * Signatures are never changed once committed, so entries never go stale.
+ */
+class SignatureCache
+{
+public:
+    using Entry = std::shared_ptr<const CachedSignature>;
+
+    /** The default number of shards. */
+    static const size_t DefaultNumShards = 16;
+
+    /**
+     * Construct an empty cache.
+     *
+     * @param budget     the approximate number of bytes to use at most
+     * @param num_shards the number of independently locked shards
+     */
+    SignatureCache(size_t budget, size_t num_shards = DefaultNumShards);
+
+    /**
+     * Destruct the cache.
+     */
+    ~SignatureCache();
+
+    SignatureCache(const SignatureCache&) = delete;
+    SignatureCache& operator=(const SignatureCache&) = delete;
+
+    /**
+     * Look up a signature and mark it as recently used.
+     *
+     * @returns the cached signature, or nullptr if it isn't cached. The entry
+     * stays valid even if it is evicted while in use.
+     */
+    Entry Find(int64_t signature_id);
+
+    /**
+     * Add a signature, evicting the least recently used signatures of its
+     * shard until it fits the budget.
+     */
+    void Insert(int64_t signature_id, Entry entry);
+
+    /**
+     * Remove every cached signature.
+     */
+    void Clear();
+
+    /**
+     * Get the statistics summed over every shard.
+     */
+    SignatureCacheStats GetStats() const;
+
+    /**
+     * Get the memory budget in bytes.
+     */
+    size_t GetBudget() const
+    {
+        return budget_;
+    }
+
+private:
+    /**
+     * A part of the cache with its own lock.
+     */
+    struct Shard
+    {
+        using List = std::list<std::pair<int64_t, Entry>>;
+
+        mutable std::mutex mutex;
+        List entries;
+        std::unordered_map<int64_t, List::iterator> index;
+        SignatureCacheStats stats;
+    };
+
+    /**
+     * Get the shard that a signature belongs to.
+     */
+    Shard& GetShard(int64_t signature_id)
+    {
+        return shards_[static_cast<uint64_t>(signature_id) % shards_.size()];
+    }
+
+    /**
+     * Evict the least recently used signatures of a shard until it uses at
+     * most `size` bytes.
+     */
+    void Evict(Shard& shard, size_t size);
+
+    /**
+     * Get the approximate number of bytes a cached signature uses.
+     */
+    static size_t GetEntrySize(const CachedSignature& entry);
+
+private:
+    std::vector<Shard> shards_;
+    size_t budget_;
+    size_t shard_budget_;
+};
+
+}
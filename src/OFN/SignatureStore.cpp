@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include <new>
+#include <cstring>
+#include <algorithm>
+
+#include "SQLite3/SQLite3.h"
+#include "OFN/Puzzle.h"
+
+#include "OFN/SignatureStore.h"
+
+using namespace OFN;
+
+SignatureStore::SignatureStore() :
+    data_(nullptr),
+    capacity_(0),
+    vector_size_(0),
+    stride_(0),
+    sketch_words_(0)
+{
+}
+
+SignatureStore::~SignatureStore()
+{
+    free(data_);
+}
+
+bool SignatureStore::Load(SQLite3::Connection& conn)
+{
+    auto count_statement = conn.Prepare("SELECT COUNT(*) FROM signatures");
+    auto statement = conn.Prepare(
+        "SELECT id, image_id, compressed_signature FROM signatures");
+
+    size_t count = 0;
+
+    if (!count_statement || !statement)
+        return false;
+
+    if (auto row = count_statement->Step())
+        count = row.GetInt64(0);
+
+    std::vector<signed char> vec;
+
+    while (auto row = statement->Step())
+    {
+        auto signature = row.GetBlob(2);
+
+        // Every signature goes through the same buffer on its way into the
+        // arena.
+        if (!Puzzle::Uncompress(signature.data(), signature.size(), vec))
+            continue;
+
+        if (!Add(row.GetInt64(0), row.GetInt64(1), vec.data(), vec.size()))
+            return false;
+
+        // The stride is known once the first signature is in, so allocate
+        // the whole arena up front instead of growing it repeatedly.
+        if (GetCount() == 1)
+            Reserve(count);
+    }
+
+    return statement->IsDone();
+}
+
+bool SignatureStore::Add(int64_t signature_id, int64_t image_id,
+                         const signed char* vec, size_t size)
+{
+    if (vector_size_ == 0)
+    {
+        vector_size_ = size;
+        stride_ = (size + Alignment - 1) / Alignment * Alignment;
+        sketch_words_ = Puzzle::GetSketchWords(size);
+    }
+    else if (size != vector_size_)
+    {
+        return false;
+    }
+
+    auto index = GetCount();
+
+    Reserve(index + 1);
+
+    // The padding after the vector stays zeroed from Reserve.
+    memcpy(data_ + index * stride_, vec, size);
+
+    sketches_.resize((index + 1) * sketch_words_);
+    Puzzle::ComputeSketch(vec, size, &sketches_[index * sketch_words_]);
+
+    signature_ids_.push_back(signature_id);
+    image_ids_.push_back(image_id);
+
+    return true;
+}
+
+void SignatureStore::Reserve(size_t count)
+{
+    if (count <= capacity_)
+        return;
+
+    auto capacity = std::max<size_t>(std::max(count, capacity_ * 2), 1024);
+    void* data;
+
+    if (posix_memalign(&data, Alignment, capacity * stride_) != 0)
+        throw std::bad_alloc();
+
+    if (data_ != nullptr)
+        memcpy(data, data_, GetCount() * stride_);
+
+    memset(static_cast<char*>(data) + GetCount() * stride_, 0,
+           (capacity - GetCount()) * stride_);
+
+    free(data_);
+
+    data_ = static_cast<signed char*>(data);
+    capacity_ = capacity;
+
+    sketches_.reserve(capacity * sketch_words_);
+    signature_ids_.reserve(capacity);
+    image_ids_.reserve(capacity);
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#pragma once
+
+/**
+ * @file SignatureStore.h
+ * @brief Contiguous in-memory store of uncompressed signatures.
+ * @author Mikkel Kroman
+ */
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+namespace OFN
+{
+
+namespace SQLite3
+{
+class Connection;
+}
+
+namespace Puzzle
+{
+class Context;
+}
+
+/**
+ * %SignatureStore class.
+ *
+ * Keeps every signature uncompressed in one cache-aligned arena where each
+ * row has the same stride, with parallel arrays of sketches and of signature
+ * and image ids.
+ * This lets a search stream over the whole collection linearly instead of
+ * decompressing candidates one at a time.
+ */
+class SignatureStore
+{
+public:
+    /** The alignment of the arena and of every row, in bytes. */
+    static const size_t Alignment = 64;
+
+    /**
+     * Construct an empty store.
+     */
+    SignatureStore();
+
+    /**
+     * Destruct the store.
+     */
+    ~SignatureStore();
+
+    SignatureStore(const SignatureStore&) = delete;
+    SignatureStore& operator=(const SignatureStore&) = delete;
+
+    /**
+     * Load and uncompress every signature in the `signatures` table.
+     *
+     * @param conn the database connection to read from
+     *
+     * @returns true on success, false otherwise.
+     */
+    bool Load(SQLite3::Connection& conn);
+
+    /**
+     * Append a signature to the store.
+     *
+     * The first signature decides the vector size of the store.
+     *
+     * @param signature_id the signature id
+     * @param image_id     the image id
+     * @param vec          the uncompressed signature
+     * @param size         the number of elements in the signature
+     *
+     * @returns true on success, false if the size does not match the store.
+     */
+    bool Add(int64_t signature_id, int64_t image_id, const signed char* vec,
+             size_t size);
+
+    /**
+     * Get the number of signatures in the store.
+     */
+    size_t GetCount() const
+    {
+        return signature_ids_.size();
+    }
+
+    /**
+     * Get the number of elements in each signature.
+     */
+    size_t GetVectorSize() const
+    {
+        return vector_size_;
+    }
+
+    /**
+     * Get the distance in bytes between two consecutive rows.
+     */
+    size_t GetStride() const
+    {
+        return stride_;
+    }
+
+    /**
+     * Get a pointer to a row.
+     *
+     * @param index the row index
+     */
+    const signed char* GetRow(size_t index) const
+    {
+        return data_ + index * stride_;
+    }
+
+    /**
+     * Get the sketch of a row.
+     *
+     * @see Puzzle::ComputeSketch
+     */
+    const uint64_t* GetSketch(size_t index) const
+    {
+        return sketches_.data() + index * sketch_words_;
+    }
+
+    /**
+     * Get the signature id of a row.
+     */
+    int64_t GetSignatureID(size_t index) const
+    {
+        return signature_ids_[index];
+    }
+
+    /**
+     * Get the image id of a row.
+     */
+    int64_t GetImageID(size_t index) const
+    {
+        return image_ids_[index];
+    }
+
+private:
+    /**
+     * Grow the arena so it can hold at least `count` rows.
+     */
+    void Reserve(size_t count);
+
+    signed char* data_;
+    size_t capacity_;
+    size_t vector_size_;
+    size_t stride_;
+    size_t sketch_words_;
+    std::vector<uint64_t> sketches_;
+    std::vector<int64_t> signature_ids_;
+    std::vector<int64_t> image_ids_;
+};
+
+}
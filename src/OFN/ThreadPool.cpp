@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#include "OFN/ThreadPool.h"
+
+using namespace OFN;
+
+ThreadPool::ThreadPool(size_t num_threads, ExitFunc on_exit) :
+    num_threads_(num_threads > 0 ? num_threads : 1),
+    ranges_(new Range[num_threads_]),
+    on_exit_(std::move(on_exit)),
+    task_(nullptr),
+    generation_(0),
+    active_(0),
+    stop_(false)
+{
+    for (size_t i = 0; i < num_threads_; i++)
+    {
+        ranges_[i].next = 0;
+        ranges_[i].end = 0;
+    }
+
+    for (size_t i = 1; i < num_threads_; i++)
+        threads_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+
+    start_.notify_all();
+
+    for (auto& thread : threads_)
+        thread.join();
+}
+
+void ThreadPool::Run(size_t num_tasks, const Task& task)
+{
+    // Split the tasks into one contiguous range per worker.
+    for (size_t i = 0; i < num_threads_; i++)
+    {
+        ranges_[i].next = num_tasks * i / num_threads_;
+        ranges_[i].end = num_tasks * (i + 1) / num_threads_;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        task_ = &task;
+        active_ = threads_.size();
+        error_ = nullptr;
+        generation_++;
+    }
+
+    start_.notify_all();
+
+    Work(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    done_.wait(lock, [this] { return active_ == 0; });
+    task_ = nullptr;
+
+    if (error_)
+        std::rethrow_exception(error_);
+}
+
+void ThreadPool::WorkerLoop(size_t worker)
+{
+    size_t generation = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            start_.wait(lock, [&] {
+                return stop_ || generation_ != generation;
+            });
+
+            if (stop_)
+                break;
+
+            generation = generation_;
+        }
+
+        Work(worker);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            if (--active_ == 0)
+                done_.notify_one();
+        }
+    }
+
+    if (on_exit_)
+        on_exit_();
+}
+
+void ThreadPool::Work(size_t worker)
+{
+    // Start with our own range, then steal from the others in turn.
+    for (size_t i = 0; i < num_threads_; i++)
+    {
+        auto& range = ranges_[(worker + i) % num_threads_];
+        size_t index;
+
+        while ((index = range.next.fetch_add(1)) < range.end)
+        {
+            try
+            {
+                (*task_)(worker, index);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                if (!error_)
+                    error_ = std::current_exception();
+            }
+        }
+    }
+}
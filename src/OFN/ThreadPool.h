@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#pragma once
+
+/**
+ * @file ThreadPool.h
+ * @brief Fixed-size thread pool with work stealing.
+ * @author Mikkel Kroman
+ */
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+namespace OFN
+{
+
+/**
+ * %ThreadPool class.
+ *
+ * Runs a batch of numbered tasks across a fixed set of threads. Every worker
+ * starts on its own contiguous range of tasks and, once that runs dry, steals
+ * the remaining tasks of the other workers, so uneven tasks still keep all
+ * threads busy.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * A task callback.
+     *
+     * The first argument is the index of the worker running the task, which
+     * is stable for the duration of a batch and can be used to index
+     * per-worker state. The second argument is the task number.
+     */
+    using Task = std::function<void(size_t, size_t)>;
+
+    /**
+     * A callback run by every worker thread just before it exits, e.g. to
+     * release per-thread resources acquired by tasks.
+     */
+    using ExitFunc = std::function<void()>;
+
+    /**
+     * Construct a pool.
+     *
+     * @param num_threads the number of workers, including the calling thread
+     * @param on_exit     the callback to run when a worker thread exits
+     */
+    explicit ThreadPool(size_t num_threads, ExitFunc on_exit = nullptr);
+
+    /**
+     * Destruct the pool, joining every thread.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Get the number of workers.
+     */
+    size_t GetNumThreads() const
+    {
+        return num_threads_;
+    }
+
+    /**
+     * Run a batch of tasks and wait for them to finish.
+     *
+     * The calling thread works on the batch as worker 0. Batches must not be
+     * run from more than one thread at a time.
+     *
+     * @param num_tasks the number of tasks
+     * @param task      the callback to run for every task
+     *
+     * @throws the first exception thrown by a task.
+     */
+    void Run(size_t num_tasks, const Task& task);
+
+private:
+    /**
+     * A range of tasks owned by a worker, padded to a cache line so workers
+     * do not contend on each other's counters.
+     */
+    struct Range
+    {
+        std::atomic<size_t> next;
+        size_t end;
+        char padding[64 - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+    };
+
+    /**
+     * The loop run by every thread except the caller.
+     */
+    void WorkerLoop(size_t worker);
+
+    /**
+     * Run tasks until no worker has any left.
+     */
+    void Work(size_t worker);
+
+    size_t num_threads_;
+    std::vector<std::thread> threads_;
+    std::unique_ptr<Range[]> ranges_;
+    ExitFunc on_exit_;
+
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    const Task* task_;
+    size_t generation_;
+    size_t active_;
+    bool stop_;
+    std::exception_ptr error_;
+};
+
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+
+#pragma once
+
+/**
+ * @file TopK.h
+ * @brief Bounded heap that keeps the K best items.
+ * @author Mikkel Kroman
+ */
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+#include <functional>
+
+namespace OFN
+{
+
+/**
+ * %TopK class.
+ *
+ * Keeps the `K` smallest items pushed to it according to `Compare`. The worst
+ * kept item sits at the top of a max-heap, so rejecting an item that cannot
+ * make it in is a single comparison.
+ */
+template <typename T, typename Compare = std::less<T>>
+class TopK
+{
+public:
+    /**
+     * Construct an empty heap.
+     *
+     * @param k the maximum number of items to keep
+     */
+    explicit TopK(size_t k = 0, Compare compare = Compare()) :
+        k_(k),
+        compare_(compare)
+    {
+        items_.reserve(k);
+    }
+
+    /**
+     * Offer an item to the heap.
+     *
+     * @returns true if the item was kept, false otherwise.
+     */
+    bool Push(const T& item)
+    {
+        if (items_.size() < k_)
+        {
+            items_.push_back(item);
+            std::push_heap(items_.begin(), items_.end(), compare_);
+
+            return true;
+        }
+
+        if (k_ == 0 || !compare_(item, items_.front()))
+            return false;
+
+        std::pop_heap(items_.begin(), items_.end(), compare_);
+        items_.back() = item;
+        std::push_heap(items_.begin(), items_.end(), compare_);
+
+        return true;
+    }
+
+    /**
+     * Offer every item of another heap to this one.
+     */
+    void Merge(const TopK& other)
+    {
+        for (auto& item : other.items_)
+            Push(item);
+    }
+
+    /**
+     * Check whether the heap holds `K` items.
+     */
+    bool IsFull() const
+    {
+        return items_.size() >= k_;
+    }
+
+    /**
+     * Get the worst item kept so far.
+     *
+     * Only valid if the heap is not empty.
+     */
+    const T& GetWorst() const
+    {
+        return items_.front();
+    }
+
+    /**
+     * Get the maximum number of items kept.
+     */
+    size_t GetCapacity() const
+    {
+        return k_;
+    }
+
+    /**
+     * Get the number of items kept.
+     */
+    size_t GetSize() const
+    {
+        return items_.size();
+    }
+
+    /**
+     * Take the kept items out of the heap, best first.
+     */
+    std::vector<T> TakeSorted()
+    {
+        std::sort_heap(items_.begin(), items_.end(), compare_);
+
+        return std::move(items_);
+    }
+
+private:
+    size_t k_;
+    Compare compare_;
+    std::vector<T> items_;
+};
+
+}
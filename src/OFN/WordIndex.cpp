@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#include <algorithm>
+
+#include "SQLite3/SQLite3.h"
+
+#include "OFN/WordIndex.h"
+
+using namespace OFN;
+
+const size_t WordKeys::Capacity;
+
+WordIndex::WordIndex() :
+    num_postings_(0)
+{
+}
+
+WordIndex::~WordIndex()
+{
+}
+
+bool WordIndex::Load(SQLite3::Connection& conn)
+{
+    // Reading in signature id order keeps every posting list sorted without
+    // having to search for the insertion point.
+    auto statement = conn.Prepare(
+        "SELECT word_key, signature_id FROM words ORDER BY signature_id");
+
+    if (!statement)
+        return false;
+
+    postings_.clear();
+    num_postings_ = 0;
+
+    while (auto row = statement->Step())
+        Insert(row.GetInt64(0), row.GetInt64(1));
+
+    return statement->IsDone();
+}
+
+void WordIndex::Insert(Key key, int64_t signature_id)
+{
+    auto& list = postings_[key];
+    auto id = static_cast<uint32_t>(signature_id);
+
+    if (list.empty() || list.back() < id)
+    {
+        list.push_back(id);
+    }
+    else
+    {
+        auto it = std::lower_bound(list.begin(), list.end(), id);
+
+        if (it != list.end() && *it == id)
+            return;
+
+        list.insert(it, id);
+    }
+
+    num_postings_++;
+}
+
+const WordIndex::PostingList* WordIndex::Find(Key key) const
+{
+    auto it = postings_.find(key);
+
+    if (it == postings_.end())
+        return nullptr;
+
+    return &it->second;
+}
+
+CandidateVector WordIndex::Vote(const WordKeys& keys, size_t limit,
+                                int min_votes) const
+{
+    std::unordered_map<uint32_t, int> votes;
+
+    Vote(keys, votes);
+
+    return RankVotes(votes, limit, min_votes);
+}
+
+void WordIndex::Vote(const WordKeys& keys,
+                     std::unordered_map<uint32_t, int>& votes) const
+{
+    for (auto key : keys)
+    {
+        if (auto list = Find(key))
+        {
+            for (auto id : *list)
+                votes[id]++;
+        }
+    }
+}
+
+WordIndex::Key WordIndex::MakeKey(size_t position, const signed char* word)
+{
+    Key value = 0;
+
+    for (size_t i = 0; i < WordLength; i++)
+        value = value * 5 + (word[i] + 2);
+
+    return static_cast<Key>(position) << ValueBits | value;
+}
+
+void WordIndex::MakeKeys(const signed char* vec, size_t size,
+                         size_t num_words, WordKeys& keys)
+{
+    keys.size = 0;
+
+    if (size <= WordLength)
+        return;
+
+    num_words = std::min({ num_words, size - WordLength, WordKeys::Capacity });
+
+    for (size_t i = 0; i < num_words; i++)
+        keys.keys[i] = MakeKey(i, vec + i);
+
+    keys.size = num_words;
+}
+
+CandidateVector OFN::RankVotes(const std::unordered_map<uint32_t, int>& votes,
+                               size_t limit, int min_votes)
+{
+    CandidateVector result;
+
+    result.reserve(votes.size());
+
+    for (auto& vote : votes)
+    {
+        if (vote.second >= min_votes)
+            result.push_back({ vote.first, vote.second });
+    }
+
+    auto by_votes = [](const Candidate& a, const Candidate& b) {
+        return a.votes != b.votes ? a.votes > b.votes
+                                  : a.signature_id < b.signature_id;
+    };
+
+    if (result.size() > limit)
+    {
+        std::partial_sort(result.begin(), result.begin() + limit, result.end(),
+                          by_votes);
+        result.resize(limit);
+    }
+    else
+    {
+        std::sort(result.begin(), result.end(), by_votes);
+    }
+
+    return result;
+}
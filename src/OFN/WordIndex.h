@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2015 Mikkel Kroman, All rights reserved.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3.0 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ */
+
+#pragma once
+
+/**
+ * @file WordIndex.h
+ * @brief In-memory inverted index from words to signatures.
+ * @author Mikkel Kroman
+ */
+
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+namespace OFN
+{
+
+namespace SQLite3
+{
+class Connection;
+}
+
+/**
+ * A signature candidate produced by a word lookup.
+ */
+struct Candidate
+{
+    /** The signature id. */
+    int64_t signature_id;
+
+    /** The number of words the signature shares with the query. */
+    int votes;
+};
+
+using CandidateVector = std::vector<Candidate>;
+
+/** A packed (position, word) key, see WordIndex::MakeKey. */
+using WordKey = int64_t;
+
+/**
+ * A fixed-capacity list of word keys.
+ *
+ * The keys live inside the object, so a list on the stack lets the words of
+ * a signature be extracted without touching the heap.
+ */
+struct WordKeys
+{
+    /** The maximum number of keys. */
+    static const size_t Capacity = 512;
+
+    WordKey keys[Capacity];
+    size_t size = 0;
+
+    const WordKey* begin() const
+    {
+        return keys;
+    }
+
+    const WordKey* end() const
+    {
+        return keys + size;
+    }
+};
+
+/**
+ * Turn per-signature vote counts into a ranked list of candidates.
+ *
+ * @param votes     the number of shared words, keyed by signature id
+ * @param limit     the maximum number of candidates to return
+ * @param min_votes the number of shared words a candidate needs at least
+ *
+ * @returns the candidates in descending vote order, ties broken by the oldest
+ * signature.
+ */
+CandidateVector RankVotes(const std::unordered_map<uint32_t, int>& votes,
+                          size_t limit, int min_votes = 1);
+
+/**
+ * %WordIndex class.
+ *
+ * Maps a word key to a sorted posting list of signature ids, so the
+ * candidates for a query can be found without touching the `words` table.
+ *
+ * A word key packs the position of a word within the signature together with
+ * its ten values, see MakeKey.
+ */
+class WordIndex
+{
+public:
+    using Key = WordKey;
+
+    /** The number of signature values in a word. */
+    static const size_t WordLength = 10;
+
+    /** The number of key bits that hold the word values. */
+    static const int ValueBits = 24;
+    using PostingList = std::vector<uint32_t>;
+
+    /**
+     * Construct an empty index.
+     */
+    WordIndex();
+
+    /**
+     * Destruct the index.
+     */
+    ~WordIndex();
+
+    /**
+     * Build the index from the `words` table.
+     *
+     * @param conn the database connection to read from
+     *
+     * @returns true on success, false otherwise.
+     */
+    bool Load(SQLite3::Connection& conn);
+
+    /**
+     * Add a signature to the posting list of a key.
+     *
+     * @param key          the packed word key
+     * @param signature_id the signature id
+     */
+    void Insert(Key key, int64_t signature_id);
+
+    /**
+     * Find the posting list of a key.
+     *
+     * @returns a pointer to the posting list, or nullptr if the key is unknown.
+     */
+    const PostingList* Find(Key key) const;
+
+    /**
+     * Count how many of the given keys each signature is listed under.
+     *
+     * @param keys      the packed word keys of the query
+     * @param limit     the maximum number of candidates to return
+     * @param min_votes the number of shared words a candidate needs at least
+     *
+     * @returns the candidates in descending vote order.
+     */
+    CandidateVector Vote(const WordKeys& keys, size_t limit,
+                         int min_votes = 1) const;
+
+    /**
+     * Count how many of the given keys each signature is listed under.
+     *
+     * @param keys  the packed word keys of the query
+     * @param votes the vote counts to add to, keyed by signature id
+     */
+    void Vote(const WordKeys& keys,
+              std::unordered_map<uint32_t, int>& votes) const;
+
+    /**
+     * Get the number of distinct keys.
+     */
+    size_t GetNumKeys() const
+    {
+        return postings_.size();
+    }
+
+    /**
+     * Get the total number of postings.
+     */
+    size_t GetNumPostings() const
+    {
+        return num_postings_;
+    }
+
+    /**
+     * Pack a word and its position into a key.
+     *
+     * Each of the ten values in -2..2 is a base-5 digit, so the word fits in
+     * the lower ValueBits bits and the position is stored above it. Keys are
+     * never negative and sort by position first.
+     *
+     * @param position the position of the word in the signature
+     * @param word     a pointer to WordLength signature values
+     *
+     * @returns the packed key.
+     */
+    static Key MakeKey(size_t position, const signed char* word);
+
+    /**
+     * Get the word keys of a signature.
+     *
+     * Word `i` is the WordLength values starting at offset `i`, so at most
+     * `size - WordLength` words are taken, and never more than the capacity
+     * of the list.
+     *
+     * @param vec       the signature values
+     * @param size      the number of signature values
+     * @param num_words the maximum number of words
+     * @param keys      the list to replace with the keys, in position order
+     */
+    static void MakeKeys(const signed char* vec, size_t size, size_t num_words,
+                         WordKeys& keys);
+
+private:
+    std::unordered_map<Key, PostingList> postings_;
+    size_t num_postings_;
+};
+
+}
@@ -15,31 +15,127 @@
  * License along with this library.
  */
 
+#include <cmath>
+#include <cerrno>
+#include <cctype>
+#include <cstdint>
 #include <getopt.h>
 #include <cstring>
+#include <cstdlib>
+#include <cinttypes>
+#include <thread>
+#include <algorithm>
 
 #include "OFN/OFN.h"
 #include "OFN/Image.h"
 #include "OFN/Context.h"
 #include "OFN/Puzzle.h"
+#include "OFN/IngestPipeline.h"
+#include "OFN/SQLite3/Errors.h"
 
 using namespace OFN;
 
 /** Command-line options. */
 static constexpr struct option CommandLineOptions[] = {
     { "help",    no_argument, 0, 'h' },
-    { "version", no_argument, 0, 'v' }
+    { "version", no_argument, 0, 'v' },
+    { "index",   no_argument, 0, 'i' },
+    { "exact",   no_argument, 0, 'e' },
+    { "threads", required_argument, 0, 'j' },
+    { "matches", required_argument, 0, 'k' },
+    { "threshold", required_argument, 0, 't' },
+    { "chunk-size", required_argument, 0, 'c' },
+    { "database", required_argument, 0, 'd' },
+    { "profile", required_argument, 0, 'p' },
+    { "pragma", required_argument, 0, 'o' },
+    { "words", required_argument, 0, 'w' },
+    { "cache-size", required_argument, 0, 'm' },
+    { "min-votes", required_argument, 0, 'n' },
+    { "max-frequency", required_argument, 0, 'f' },
+    { 0, 0, 0, 0 }
 };
 
 /** Command-line command arguments. */
 static constexpr struct Application::Command Commands[] = {
     { "commit",  &Application::Commit },
     { "search",  &Application::Search },
-    { "process", &Application::Process }
+    { "process", &Application::Process },
+    { "reindex", &Application::Reindex },
+    { "migrate", &Application::Migrate },
+    { "candidates", &Application::Candidates },
+    { "check", &Application::Check }
 };
 
+/**
+ * Parse a whole option value as a decimal integer.
+ *
+ * @returns true if the value is a number between min and max, false
+ * otherwise.
+ */
+static bool ParseInteger(const char* text, unsigned long long min,
+                         unsigned long long max, unsigned long long& value)
+{
+    char* end;
+
+    // strtoull accepts a sign and negates the result, so reject it up front.
+    if (!std::isdigit(static_cast<unsigned char>(text[0])))
+        return false;
+
+    errno = 0;
+    value = std::strtoull(text, &end, 10);
+
+    return errno == 0 && *end == '\0' && value >= min && value <= max;
+}
+
+/**
+ * Parse a whole option value as a fraction in (0, 1].
+ *
+ * @returns true if the value is such a number, false otherwise.
+ */
+static bool ParseFraction(const char* text, double& value)
+{
+    char* end;
+
+    errno = 0;
+    value = std::strtod(text, &end);
+
+    return errno == 0 && end != text && *end == '\0' && std::isfinite(value) &&
+           value > 0.0 && value <= 1.0;
+}
+
+/**
+ * Encode a raw digest as lowercase hex.
+ */
+static std::string HexDigest(const std::string& digest)
+{
+    static const char* digits = "0123456789abcdef";
+    std::string result;
+
+    result.reserve(digest.size() * 2);
+
+    for (unsigned char c : digest)
+    {
+        result.push_back(digits[c >> 4]);
+        result.push_back(digits[c & 0x0f]);
+    }
+
+    return result;
+}
+
 Application::Application() :
-    context_(std::make_shared<Context>())
+    max_matches_(MaxMatches),
+    threshold_(SimilarityThreshold),
+    commit_chunk_size_(CommitChunkSize),
+    num_threads_(0),
+    num_words_(Image::DEFAULT_WORDS),
+    cache_size_(SignatureCacheSize),
+    min_votes_(MinVotes),
+    max_word_frequency_(MaxWordFrequency),
+    set_num_threads_(false),
+    load_word_index_(false),
+    load_signature_store_(false),
+    database_path_(Context::DefaultDatabasePath),
+    profile_("default")
 {
 #ifndef NDEBUG
     spdlog::set_level(spdlog::level::debug);
@@ -54,55 +150,168 @@ void Application::Search(std::vector<std::string> parameters)
 {
     auto console = spdlog::get("console");
 
-    for (auto filename : parameters)
+    for (size_t offset = 0; offset < parameters.size(); offset += BatchSize)
     {
-        try
-        {
-            console->info("Searching for images similar to '{}'", filename);
-            auto image = std::make_unique<OFN::Image>(context_, filename);
+        auto count = std::min(BatchSize, parameters.size() - offset);
+        std::vector<std::unique_ptr<Image>> images;
+        std::vector<const Image*> queries;
 
-            context_->Search(*image);
-        }
-        catch (const Puzzle::RuntimeError& error)
+        for (size_t i = offset; i < offset + count; i++)
         {
-            console->error("Puzzle::RuntimeError: {}", error.what());
+            auto& filename = parameters[i];
+
+            try
+            {
+                console->info("Searching for images similar to '{}'",
+                              filename);
+
+                images.push_back(context_->OpenImage(filename));
+                queries.push_back(images.back().get());
+            }
+            catch (const Puzzle::RuntimeError& error)
+            {
+                console->error("Puzzle::RuntimeError: {}", error.what());
+            }
         }
+
+        auto results = context_->SearchBatch(queries, max_matches_, threshold_);
+
+        for (size_t i = 0; i < results.size(); i++)
+            PrintMatches(images[i]->GetFileName(), results[i]);
+    }
+}
+
+void Application::PrintMatches(const std::string& filename,
+                               const MatchVector& matches)
+{
+    // One tab-separated line per match: query, distance, image id, digest and
+    // filename.
+    for (auto& match : matches)
+    {
+        printf("%s\t%.6f\t%" PRId64 "\t%s\t%s\n", filename.c_str(),
+               match.distance, match.image_id, HexDigest(match.digest).c_str(),
+               match.filename.c_str());
     }
 }
 
 void Application::Commit(std::vector<std::string> parameters)
 {
     auto console = spdlog::get("console");
+    IngestPipeline pipeline(*context_, num_threads_, commit_chunk_size_);
+
+    console->debug("Committing {} images with {} decode workers",
+                   parameters.size(), pipeline.GetNumWorkers());
+
+    pipeline.Run(parameters);
+}
+
+void Application::Process(std::vector<std::string> parameters)
+{
+    auto console = spdlog::get("console");
+
+    if (parameters.empty())
+        throw CommandLineError("No file given");
+
+    auto filename = parameters[0];
+
+    try
+    {
+        auto image = context_->OpenImage(filename);
+    }
+    catch (const Puzzle::RuntimeError& error)
+    {
+        console->error("Puzzle::RuntimeError: {}", error.what());
+    }
+}
+
+void Application::Reindex(std::vector<std::string> parameters)
+{
+    (void)parameters;
+    auto console = spdlog::get("console");
+
+    console->info("Rebuilding the word index file");
+
+    if (context_->BuildIndexFile())
+        console->info("Finished rebuilding the word index file");
+}
+
+void Application::Migrate(std::vector<std::string> parameters)
+{
+    (void)parameters;
+    auto console = spdlog::get("console");
+
+    console->info("Migrating the words table");
+
+    if (context_->MigrateWords())
+        console->info("Finished migrating the words table");
+}
+
+void Application::Candidates(std::vector<std::string> parameters)
+{
+    auto console = spdlog::get("console");
+    CandidateReport total;
 
-    for (auto filename : parameters)
+    if (parameters.empty())
+        throw CommandLineError("No file given");
+
+    // One tab-separated line per image: filename, words, ignored words,
+    // candidates and the candidates left after pruning.
+    for (auto& filename : parameters)
     {
         try
         {
-            console->info("Comitting image '{}'", filename);
+            auto image = context_->OpenImage(filename);
+            auto report = context_->ReportCandidates(*image);
 
-            auto image = std::make_unique<OFN::Image>(context_, filename);
+            printf("%s\t%zu\t%zu\t%zu\t%zu\n", filename.c_str(), report.words,
+                   report.stopped_words, report.candidates, report.selected);
 
-            context_->Commit(*image);
+            total.words += report.words;
+            total.stopped_words += report.stopped_words;
+            total.candidates += report.candidates;
+            total.selected += report.selected;
         }
         catch (const Puzzle::RuntimeError& error)
         {
-            console->error("Puzzle error: {}", error.what());
+            console->error("Puzzle::RuntimeError: {}", error.what());
         }
     }
+
+    console->info("Ignored {} of {} words, leaving {} of {} candidates "
+                  "({:.1f}% fewer)",
+                  total.stopped_words, total.words, total.selected,
+                  total.candidates,
+                  total.candidates ? 100.0 - 100.0 * total.selected /
+                                                 total.candidates
+                                   : 0.0);
 }
 
-void Application::Process(std::vector<std::string> parameters)
+void Application::Check(std::vector<std::string> parameters)
 {
+    (void)parameters;
     auto console = spdlog::get("console");
-    auto filename = parameters[0];
+    const Puzzle::DistanceKernel kernels[] = {
+        Puzzle::DistanceKernel::Scalar,
+        Puzzle::DistanceKernel::SSE41,
+        Puzzle::DistanceKernel::AVX2
+    };
 
-    try
+    for (auto kernel : kernels)
     {
-        auto image = std::make_unique<OFN::Image>(context_, filename);
-    }
-    catch (const Puzzle::RuntimeError& error)
-    {
-        console->error("Puzzle::RuntimeError: {}", error.what());
+        auto name = Puzzle::GetDistanceKernelName(kernel);
+
+        if (!Puzzle::IsDistanceKernelSupported(kernel))
+        {
+            console->info("Skipping the {} distance kernel, which this CPU "
+                          "does not support", name);
+            continue;
+        }
+
+        if (Puzzle::CheckDistanceKernel(kernel, KernelCheckTrials))
+            console->info("The {} distance kernel matches libpuzzle", name);
+        else
+            console->error("The {} distance kernel differs from libpuzzle",
+                           name);
     }
 }
 
@@ -121,8 +330,8 @@ ParameterList Application::ParseParameters(int argc, char* argv[])
         return ParameterList();
     }
 
-    while ((option = getopt_long(argc, argv, "hv", CommandLineOptions, &idx)) !=
-           -1)
+    while ((option = getopt_long(argc, argv, "hviej:k:t:c:d:p:o:w:m:n:f:",
+                                 CommandLineOptions, &idx)) != -1)
     {
         if (option == 'h')
         {
@@ -134,20 +343,178 @@ ParameterList Application::ParseParameters(int argc, char* argv[])
         {
             printf("OFN %s (c) Mikkel Kroman\n\n", OFN::Version);
         }
+        else if (option == 'i')
+        {
+            load_word_index_ = true;
+        }
+        else if (option == 'e')
+        {
+            load_signature_store_ = true;
+        }
+        else if (option == 'j')
+        {
+            unsigned long long threads;
+            auto limit = MaxThreadsPerCore *
+                         std::max(1u, std::thread::hardware_concurrency());
+
+            if (!ParseInteger(optarg, 0, limit, threads))
+                throw CommandLineError(
+                    ("The number of threads must be between 0 and " +
+                     std::to_string(limit)).c_str());
+
+            num_threads_ = threads;
+            set_num_threads_ = true;
+        }
+        else if (option == 'k')
+        {
+            unsigned long long matches;
+
+            if (!ParseInteger(optarg, 1, MatchesLimit, matches))
+                throw CommandLineError(
+                    ("The number of matches must be between 1 and " +
+                     std::to_string(MatchesLimit)).c_str());
+
+            max_matches_ = matches;
+        }
+        else if (option == 't')
+        {
+            if (!ParseFraction(optarg, threshold_))
+                throw CommandLineError("The threshold must be greater than 0 "
+                                       "and at most 1");
+        }
+        else if (option == 'c')
+        {
+            unsigned long long chunk_size;
+
+            if (!ParseInteger(optarg, 0, CommitChunkSizeLimit, chunk_size))
+                throw CommandLineError(
+                    ("The chunk size must be between 0 and " +
+                     std::to_string(CommitChunkSizeLimit)).c_str());
+
+            commit_chunk_size_ = chunk_size;
+        }
+        else if (option == 'd')
+        {
+            database_path_ = optarg;
+        }
+        else if (option == 'p')
+        {
+            profile_ = optarg;
+        }
+        else if (option == 'o')
+        {
+            pragmas_.emplace_back(optarg);
+        }
+        else if (option == 'w')
+        {
+            num_words_ = std::strtoul(optarg, nullptr, 10);
+
+            if (num_words_ == 0 || num_words_ > WordKeys::Capacity)
+                throw CommandLineError(
+                    ("The number of words must be between 1 and " +
+                     std::to_string(WordKeys::Capacity)).c_str());
+        }
+        else if (option == 'm')
+        {
+            // The size is given in MiB and has to fit in bytes.
+            const unsigned long long max_size = SIZE_MAX / (1024 * 1024);
+            unsigned long long size;
+
+            if (!ParseInteger(optarg, 0, max_size, size))
+                throw CommandLineError(
+                    ("The cache size must be between 0 and " +
+                     std::to_string(max_size) + " MiB").c_str());
+
+            cache_size_ = size;
+        }
+        else if (option == 'n')
+        {
+            unsigned long long votes;
+
+            if (!ParseInteger(optarg, 1, WordKeys::Capacity, votes))
+                throw CommandLineError(
+                    ("The minimum number of votes must be between 1 and " +
+                     std::to_string(WordKeys::Capacity)).c_str());
+
+            min_votes_ = static_cast<int>(votes);
+        }
+        else if (option == 'f')
+        {
+            if (!ParseFraction(optarg, max_word_frequency_))
+                throw CommandLineError("The maximum word frequency must be "
+                                       "greater than 0 and at most 1");
+        }
     }
 
     while (optind < argc)
         parameters.emplace_back(argv[optind++]);
 
+    // Checking the distance kernels doesn't need a database.
+    if (!parameters.empty() && parameters[0] != "check")
+        OpenContext(parameters[0]);
+
     return parameters;
 }
 
+void Application::OpenContext(const std::string& command)
+{
+    SQLite3::ConnectionOptions options;
+
+    // The presets change the journal mode of the database itself, so they
+    // are only applied when asked for.
+    if (!options.LoadPreset(profile_))
+        throw CommandLineError(("Unknown profile `" + profile_ + "'").c_str());
+
+    for (auto& pragma : pragmas_)
+    {
+        if (!options.Set(pragma))
+            throw CommandLineError(
+                ("Invalid setting `" + pragma + "'").c_str());
+    }
+
+    context_ = std::make_shared<Context>(database_path_, options);
+    context_->SetNumWords(num_words_);
+    context_->SetSignatureCacheSize(cache_size_ * 1024 * 1024);
+    context_->SetMinVotes(min_votes_);
+    context_->SetMaxWordFrequency(max_word_frequency_);
+
+    if (context_->HasLegacyWords() && command != "migrate")
+        throw CommandLineError("The database uses the old words table, run "
+                               "`migrate' to convert it");
+
+    if (set_num_threads_)
+        context_->SetNumThreads(num_threads_);
+
+    if (load_word_index_)
+        context_->LoadWordIndex();
+
+    if (load_signature_store_)
+        context_->LoadSignatureStore();
+}
+
 void Application::PrintUsage(const char* executable)
 {
-    printf("Usage: %s [-h] <commit|search> <file>\n\n", executable);
+    printf("Usage: %s [-h] <commit|search> <file>\n", executable);
+    printf("       %s candidates <file>\n", executable);
+    printf("       %s <reindex|migrate|check>\n\n", executable);
     printf("ofn %s (c) Mikkel Kroman\n\n", OFN::Version);
     puts("Options:");
-    puts("  -h, --help     Display this message\n");
+    puts("  -h, --help     Display this message");
+    puts("  -i, --index    Load the word index into memory");
+    puts("  -e, --exact    Search every signature instead of using words");
+    puts("  -j, --threads  Worker threads for search and commit, 0 for all");
+    puts("  -k, --matches  Maximum number of matches to print per image");
+    puts("  -t, --threshold  Maximum normalized distance of a match");
+    puts("  -c, --chunk-size Images per commit transaction, 0 for all");
+    puts("  -d, --database Path to the database, ofn.db by default");
+    puts("  -p, --profile  Database profile: default, ingest or read-mostly");
+    puts("  -o, --pragma   Override a database setting, e.g. synchronous=OFF");
+    puts("  -w, --words    Number of words per signature, 100 by default");
+    puts("  -m, --cache-size Signature cache size in MiB, 0 to disable");
+    puts("  -n, --min-votes  Words a candidate has to share with the query, "
+         "when not scanning");
+    puts("  -f, --max-frequency Ignore words in more than this fraction of "
+         "images, when not scanning\n");
 }
 
 int main(int argc, char* argv[])
@@ -159,7 +526,7 @@ int main(int argc, char* argv[])
     {
         auto parameters = app->ParseParameters(argc, argv);
 
-        if (parameters.size() < 2)
+        if (parameters.empty())
             return 1;
 
         for (auto command : Commands)
@@ -184,6 +551,12 @@ int main(int argc, char* argv[])
     {
         console->error("Application command-line error: {}", error.what());
     }
+    catch (const SQLite3::SQLiteError& error)
+    {
+        console->error("Database error: {}", error.what());
+
+        return 1;
+    }
 
     return 0;
 }